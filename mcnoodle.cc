@@ -29,813 +29,3917 @@
 ** MCNOODLE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+extern "C"
+{
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+#include <algorithm>
+#include <atomic>
 #include <bitset>
+#include <cctype>
+#include <chrono>
+#include <functional>
 #include <map>
+#include <mutex>
+#include <thread>
 
 #include "mcnoodle.h"
 
-mcnoodle_private_key::mcnoodle_private_key(const size_t m, const size_t t)
+/*
+** NTL is built without thread support, so its global random stream
+** is shared by every thread. Whoever draws from it holds this lock.
+** The lock also guards the field contexts.
+*/
+
+static std::mutex s_ntlMutex;
+static mcnoodle_field_context *s_fieldContexts[17];
+
+/*
+** The header of a key file, see mcnoodle_key_file. headerChecksum
+** covers the bytes before it and payloadChecksum those after the
+** header.
+*/
+
+struct mcnoodle_key_file_header
 {
-  m_k = 0;
-  m_m = mcnoodle::minimumM(m);
-  m_n = 1 << m_m; // 2^m
-  m_ok = true;
-  m_t = mcnoodle::minimumT(t);
+  char magic[8];
+  uint32_t version;
+  uint32_t type;
+  uint32_t wordBits;
+  uint32_t flags;
+  uint64_t byteOrder;
+  uint64_t m;
+  uint64_t t;
+  uint64_t n;
+  uint64_t k;
+  uint64_t modulus;
+  uint64_t size;
+  uint64_t sections[8][2]; // Offset and size.
+  uint64_t payloadChecksum;
+  uint64_t headerChecksum;
+};
+
+static const char s_keyFileMagic[8] = {'m', 'c', 'n', 'o', 'o', 'd', 'l', 'e'};
+static const size_t s_keyFileAlignment = 64;
+static const uint64_t s_keyFileByteOrder = 0x0102030405060708ULL;
+static const uint32_t s_keyFileSystematic = 1;
+
+static void concatenateBits(_ntl_ulong *x,
+			    const _ntl_ulong *a,
+			    const size_t na,
+			    const _ntl_ulong *b,
+			    const size_t nb)
+{
+  /*
+  ** x = [a|b], a and b having na and nb bits. Bits of a and b past
+  ** their lengths must be clear.
+  */
+
+  size_t aw = (na + NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG;
+  size_t bw = (nb + NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG;
+  size_t shift = na % NTL_BITS_PER_LONG;
+  size_t w = na / NTL_BITS_PER_LONG;
+  size_t xw = (na + nb + NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG;
+
+  for(size_t i = 0; i < aw; i++)
+    x[i] = a[i];
+
+  for(size_t i = aw; i < xw; i++)
+    x[i] = 0;
+
+  for(size_t i = 0; i < bw; i++)
+    {
+      x[w + i] |= b[i] << shift;
 
+      if(shift != 0 && w + i + 1 < xw)
+	x[w + i + 1] |= b[i] >> (NTL_BITS_PER_LONG - shift);
+    }
+}
+
+static uint64_t checksum(const unsigned char *a, const size_t size)
+{
   /*
-  ** Some calculations.
+  ** FNV-1a.
   */
 
-  m_k = m_n - m_m * m_t;
+  uint64_t h = 14695981039346656037ULL;
+
+  for(size_t i = 0; i < size; i++)
+    {
+      h ^= a[i];
+      h *= 1099511628211ULL;
+    }
+
+  return h;
+}
 
+static void flattenRows(std::vector<_ntl_ulong> &x, const NTL::mat_GF2 &A)
+{
   /*
-  ** Prepare important containers.
+  ** The rows of A, whole words apart.
   */
 
-  prepare_gZ();
-  prepareP();
-  prepareS();
-  prepareSwappingColumns();
+  size_t w = static_cast<size_t>
+    ((A.NumCols() + NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG);
 
-  long int n = static_cast<long int> (m_n);
-  std::vector<long int> dividers;
+  x.assign(static_cast<size_t> (A.NumRows()) * w, 0);
+
+  for(long int i = 0; i < A.NumRows(); i++)
+    for(size_t j = 0; j < w; j++)
+      x[static_cast<size_t> (i) * w + j] = A[i].rep[static_cast<long int> (j)];
+}
+
+static bool layoutKeyFile
+(std::vector<unsigned char> &file,
+ mcnoodle_key_file_header &header,
+ const std::vector<std::pair<const void *, size_t> > &sections)
+{
+  /*
+  ** Lays out header and sections in file, and fills in the header's
+  ** offsets, size and checksums.
+  */
+
+  if(sections.size() > 8)
+    return false;
 
-  for(long int i = 2; i < (n - 1) / 2 + 1; i++)
-    if((n - 1) % i == 0)
-      dividers.push_back(i);
+  size_t size = s_keyFileAlignment *
+    ((sizeof(header) + s_keyFileAlignment - 1) / s_keyFileAlignment);
 
-  NTL::GF2E A = NTL::GF2E::zero();
+  memcpy(header.magic, s_keyFileMagic, sizeof(header.magic));
+  header.byteOrder = s_keyFileByteOrder;
+  header.version = mcnoodle_key_file::s_version;
+  header.wordBits = NTL_BITS_PER_LONG;
+  memset(header.sections, 0, sizeof(header.sections));
 
-  for(long int i = 2; i < n; i++)
+  for(size_t i = 0; i < sections.size(); i++)
     {
-      NTL::GF2E gf2e;
-      NTL::GF2X gf2x;
-      bool found = true;
+      header.sections[i][0] = size;
+      header.sections[i][1] = sections[i].second;
+      size += s_keyFileAlignment *
+	((sections[i].second + s_keyFileAlignment - 1) /
+	 s_keyFileAlignment);
+    }
+
+  file.assign(size, 0);
+
+  for(size_t i = 0; i < sections.size(); i++)
+    if(sections[i].second > 0)
+      memcpy(&file[header.sections[i][0]],
+	     sections[i].first,
+	     sections[i].second);
 
-      gf2x.SetLength(static_cast<long int> (m));
-      gf2x = NTL::GF2X::zero();
+  size_t start = static_cast<size_t> (header.sections[0][0]);
 
-      for(long int j = 0; j < static_cast<long int> (m); j++)
-	/*
-	** 0 or 1, selected randomly. This has the potential
-	** of introducing divisions by zero. Only a test library!
-	*/
+  header.payloadChecksum = checksum(&file[start], size - start);
+  header.size = size;
+  header.headerChecksum = checksum
+    (reinterpret_cast<const unsigned char *> (&header),
+     offsetof(mcnoodle_key_file_header, headerChecksum));
+  memcpy(&file[0], &header, sizeof(header));
+  return true;
+}
 
-	NTL::SetCoeff(gf2x, j, NTL::RandomBnd(2));
+static bool writeFile(const char *path,
+		      const std::vector<unsigned char> &file,
+		      const bool secret)
+{
+  if(!path || file.empty())
+    return false;
 
-      A = gf2e = NTL::to_GF2E(gf2x);
+  /*
+  ** A secret file is created with mode 0600, and an existing one is
+  ** restricted to it, before any of it is written.
+  */
 
-      for(int long j = 0; j < static_cast<long int> (dividers.size()); j++)
-	if(NTL::power(gf2e, dividers[j]) == NTL::to_GF2E(1))
-	  {
-	    found = false;
-	    break;
-	  }
+  int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, secret ? 0600 : 0666);
 
-      if(found)
-	{
-	  A = gf2e;
-	  break;
-	}
+  if(fd < 0)
+    return false;
+
+  if(secret && fchmod(fd, 0600) != 0)
+    {
+      close(fd);
+      return false;
     }
 
-  m_L.SetLength(n);
+  FILE *f = fdopen(fd, "wb");
 
-  for(long int i = 0; i < n; i++)
-    if(i == 0)
-      m_L[i] = NTL::GF2E::zero(); // Lambda-0 is always zero.
-    else if(i == 1)
-      m_L[i] = A; // Discovered generator.
-    else
-      m_L[i] = A * m_L[i - 1];
+  if(!f)
+    {
+      close(fd);
+      return false;
+    }
 
-  preparePreSynTab();
+  bool ok = fwrite(&file[0], 1, file.size(), f) == file.size();
+
+  ok &= fclose(f) == 0;
+  return ok;
 }
 
-mcnoodle_private_key::~mcnoodle_private_key()
+static double secondsSince(const std::chrono::steady_clock::time_point &t)
 {
+  return std::chrono::duration<double>
+    (std::chrono::steady_clock::now() - t).count();
 }
 
-bool mcnoodle_private_key::prepareG(const NTL::mat_GF2 &R)
+static void gatherBits(_ntl_ulong *x,
+		       const _ntl_ulong *a,
+		       const uint32_t *index,
+		       const size_t n)
 {
-  try
+  /*
+  ** Bit j of x becomes bit index[j] of a.
+  */
+
+  for(size_t i = 0, j = 0; j < n; i++)
     {
-      if(m_swappingColumns.size() != static_cast<size_t> (m_n))
-	{
-	  m_ok = false;
-	  return false;
-	}
+      _ntl_ulong w = 0;
 
-      long int k = static_cast<long int> (m_k);
-      long int n = static_cast<long int> (m_n);
+      for(size_t b = 0; b < NTL_BITS_PER_LONG && j < n; b++, j++)
+	w |= ((a[index[j] / NTL_BITS_PER_LONG] >>
+	       (index[j] % NTL_BITS_PER_LONG)) & 1) << b;
 
-      m_G.SetDims(k, n);
+      x[i] = w;
+    }
+}
 
-      for(long int i = 0; i < k; i++)
-	{
-	  for(long int j = 0; j < n - k; j++)
-	    m_G[i][j] = R[i][j];
+template<typename F>
+static void runWorkers(const size_t threads, const size_t limit, F &work)
+{
+  /*
+  ** Runs work on threads threads, this one among them, or on one per
+  ** core if threads is zero, but on no more than limit. Threads that
+  ** fail to start are done without. The others are joined before an
+  ** exception from this thread's work is passed on.
+  */
 
-	  m_G[i][n - k + i] = NTL::to_GF2(1);
-	}
+  size_t workers = threads;
 
-      NTL::mat_GF2 mat_GF2;
+  if(workers == 0)
+    workers = std::max
+      (static_cast<size_t> (1),
+       static_cast<size_t> (std::thread::hardware_concurrency()));
 
-      mat_GF2.SetDims(k, n);
+  workers = std::max(static_cast<size_t> (1), std::min(workers, limit));
 
-      for(long int i = 0; i < n; i++)
-	for(long int j = 0; j < k; j++)
-	  mat_GF2[j][m_swappingColumns[i]] = m_G[j][i];
+  std::vector<std::thread> pool;
 
-      m_G = mat_GF2;
+  try
+    {
+      pool.reserve(workers - 1);
+
+      for(size_t i = 1; i < workers; i++)
+	pool.push_back(std::thread(std::ref(work)));
     }
   catch(...)
     {
-      NTL::clear(m_G);
-      m_ok = false;
-      return false;
     }
 
-  m_ok &= true;
+  try
+    {
+      work();
+    }
+  catch(...)
+    {
+      for(size_t i = 0; i < pool.size(); i++)
+	pool[i].join();
+
+      throw;
+    }
+
+  for(size_t i = 0; i < pool.size(); i++)
+    pool[i].join();
+}
+
+static bool isPermutation(const uint32_t *p, const size_t n)
+{
+  std::vector<bool> seen(n, false);
+
+  for(size_t i = 0; i < n; i++)
+    if(p[i] >= n || seen[p[i]])
+      return false;
+    else
+      seen[p[i]] = true;
+
   return true;
 }
 
-bool mcnoodle_private_key::prepareP(void)
+static void mulRows(NTL::mat_GF2 &X,
+		    const NTL::mat_GF2 &A,
+		    const size_t first,
+		    const size_t rows,
+		    const NTL::mat_GF2 &B)
 {
-  try
-    {
-      long int n = static_cast<long int> (m_n);
-      std::map<long int, char> indexes;
+  /*
+  ** X = rows first through first + rows - 1 of A, times B, by NTL's
+  ** Four Russians product.
+  */
 
-      /*
-      ** 0 ... 1 ... 0 ... 0 ...
-      ** 1 ... 0 ... 0 ... 0 ...
-      ** 0 ... 0 ... 1 ... 0 ...
-      ** 0 ... 0 ... 0 ... 0 ...
-      ** 0 ... 0 ... 0 ... 1 ...
-      ** ...
-      */
+  NTL::mat_GF2 T;
 
-      m_P.SetDims(n, n);
+  T.SetDims(static_cast<long int> (rows), A.NumCols());
 
-      for(long int i = 0; i < m_P.NumRows(); i++)
-	do
-	  {
-	    long int j = NTL::RandomBnd(m_P.NumCols());
+  for(size_t i = 0; i < rows; i++)
+    T[static_cast<long int> (i)] = A[static_cast<long int> (first + i)];
 
-	    if(indexes.find(j) == indexes.end())
-	      {
-		indexes[j] = 0;
-		m_P[i][j] = 1;
-		break;
-	      }
-	  }
-	while(true);
+  NTL::mul(X, T, B);
+}
 
-      /*
-      ** A permutation matrix always has an inverse.
-      */
+static void packBytes(_ntl_ulong *x,
+		      const unsigned char *a,
+		      const size_t size,
+		      const size_t offset = 0)
+{
+  /*
+  ** Byte i of a becomes bits CHAR_BIT * (offset + i) through
+  ** CHAR_BIT * (offset + i + 1) - 1 of x, least significant first.
+  ** The destination bits must be clear.
+  */
 
-      /*
-      ** (PP^T)ij = Sum(Pik(P^T)kj, k = 1..n) = Sum(PikPjk, k = 1..n).
-      ** Sum(PikPjk, k = 1..n) = 1 if i = j, and 0 otherwise (I).
-      ** That is, PP^T = I or the inverse of P is equal to P's transpose.
-      */
+  for(size_t i = 0, j = offset; i < size; i++, j++)
+    x[j / sizeof(_ntl_ulong)] |= static_cast<_ntl_ulong> (a[i]) <<
+      (CHAR_BIT * (j % sizeof(_ntl_ulong)));
+}
 
-      m_Pinv = NTL::transpose(m_P);
-    }
-  catch(...)
-    {
-      NTL::clear(m_P);
-      NTL::clear(m_Pinv);
-      m_ok = false;
-      return false;
-    }
+static void unpackBytes(unsigned char *x,
+			const _ntl_ulong *a,
+			const size_t size)
+{
+  /*
+  ** The inverse of packBytes().
+  */
 
-  m_ok &= true;
-  return true;
+  for(size_t i = 0; i < size; i++)
+    x[i] = static_cast<unsigned char>
+      (a[i / sizeof(_ntl_ulong)] >> (CHAR_BIT * (i % sizeof(_ntl_ulong))));
 }
 
-bool mcnoodle_private_key::preparePreSynTab(void)
+static long int randomBnd(NTL::RandomStream &stream, const long int bound)
 {
-  try
-    {
-      if(!NTL::deg(m_gZ))
-	{
-	  m_ok = false;
-	  return false;
-	}
+  /*
+  ** A uniform value in [0, bound), bound < 2^32, by rejection.
+  */
 
-      long int n = static_cast<long int> (m_n);
+  uint64_t range = static_cast<uint64_t> (1) << 32;
+  uint64_t limit = range - range % static_cast<uint64_t> (bound);
 
-      if(m_L.length() != n)
-	{
-	  m_ok = false;
-	  return false;
-	}
+  for(;;)
+    {
+      unsigned char bytes[4];
+      uint64_t r = 0;
 
-      m_X.SetLength(2);
-      NTL::SetCoeff(m_X, 0, 0);
-      NTL::SetCoeff(m_X, 1, 1);
-      m_preSynTab.clear();
+      stream.get(bytes, 4);
 
-      for(long int i = 0; i < n; i++)
-	/*
-	** Division by zero will occur if m_X - m_L[i] equals zero.
-	**/
+      for(size_t i = 0; i < 4; i++)
+	r = (r << CHAR_BIT) | bytes[i];
 
-	if(!NTL::IsZero(m_X - m_L[i]))
-	  m_preSynTab.push_back(NTL::InvMod(m_X - m_L[i], m_gZ));
-	else
-	  m_preSynTab.push_back(m_X);
+      if(r < limit)
+	return static_cast<long int> (r % static_cast<uint64_t> (bound));
     }
-  catch(...)
+}
+
+static bool readVector(std::streambuf *buffer,
+		       NTL::vec_GF2 &x,
+		       const long int n)
+{
+  /*
+  ** Parses NTL's "[0 1 ...]" form of a vector of length n into x
+  ** without an intermediate copy of the stream.
+  */
+
+  if(!buffer || n <= 0)
+    return false;
+
+  int c = 0;
+
+  do
+    c = buffer->sbumpc();
+  while(std::isspace(c));
+
+  if(c != '[')
+    return false;
+
+  long int i = 0;
+
+  x.SetLength(n);
+  NTL::clear(x);
+
+  _ntl_ulong *xp = x.rep.elts();
+
+  for(;;)
     {
-      m_ok = false;
-      m_preSynTab.clear();
-      return false;
+      c = buffer->sbumpc();
+
+      if(c == ']')
+	break;
+      else if(std::isspace(c))
+	continue;
+      else if(c != '0' && c != '1')
+	return false;
+      else if(i >= n)
+	return false;
+
+      if(c == '1')
+	xp[i / NTL_BITS_PER_LONG] |=
+	  static_cast<_ntl_ulong> (1) << (i % NTL_BITS_PER_LONG);
+
+      i += 1;
     }
 
-  m_ok &= true;
-  return true;
+  return i == n;
 }
 
-bool mcnoodle_private_key::prepareS(void)
+/*
+** A keygen stage. start() runs the stage on a thread of its own, or
+** on the caller's if no thread can be had, and join() returns its
+** result.
+*/
+
+class mcnoodle_stage
 {
-  try
+ public:
+  mcnoodle_stage(void)
+  {
+    m_ok = false;
+    m_seconds = 0.0;
+  }
+
+  ~mcnoodle_stage()
+  {
+    join();
+  }
+
+  bool join(void)
+  {
+    if(m_thread.joinable())
+      m_thread.join();
+
+    return m_ok;
+  }
+
+  double seconds(void) const
+  {
+    return m_seconds;
+  }
+
+  template<typename F> void start(F f)
+  {
+    try
+      {
+	m_thread = std::thread(&mcnoodle_stage::run<F>, this, f);
+      }
+    catch(...)
+      {
+	run(f);
+      }
+  }
+
+ private:
+  bool m_ok;
+  double m_seconds;
+  std::thread m_thread;
+
+  template<typename F> void run(F f)
+  {
+    std::chrono::steady_clock::time_point start
+      (std::chrono::steady_clock::now());
+
+    try
+      {
+	m_ok = f();
+      }
+    catch(...)
+      {
+	m_ok = false;
+      }
+
+    m_seconds = secondsSince(start);
+  }
+};
+
+mcnoodle_gf2m::mcnoodle_gf2m(void)
+{
+  m_m = 0;
+  m_modulus = 0;
+  m_ok = false;
+  m_order = 0;
+}
+
+mcnoodle_gf2m::~mcnoodle_gf2m()
+{
+}
+
+NTL::GF2E mcnoodle_gf2m::toGF2E(const uint16_t a) const
+{
+  NTL::GF2X gf2x;
+
+  for(long int i = 0; i < static_cast<long int> (m_m); i++)
+    if((a >> i) & 1)
+      NTL::SetCoeff(gf2x, i, 1);
+
+  return NTL::to_GF2E(gf2x);
+}
+
+bool mcnoodle_gf2m::polyInvMod(std::vector<uint16_t> &x,
+			       const std::vector<uint16_t> &a,
+			       const std::vector<uint16_t> &g) const
+{
+  std::vector<uint16_t> scratch;
+
+  return polyInvMod(x, a, g, scratch);
+}
+
+bool mcnoodle_gf2m::polyInvMod(std::vector<uint16_t> &x,
+			       const std::vector<uint16_t> &a,
+			       const std::vector<uint16_t> &g,
+			       std::vector<uint16_t> &scratch) const
+{
+  /*
+  ** Extended Euclid. Returns false if a is not invertible modulo g.
+  ** The four working polynomials live in scratch.
+  */
+
+  long int t = polyDeg(g);
+
+  if(t < 1)
+    return false;
+
+  size_t size = static_cast<size_t> (t + 1);
+
+  scratch.assign(4 * size, 0);
+
+  uint16_t *r0 = &scratch[0];
+  uint16_t *r1 = r0 + size;
+  uint16_t *s0 = r1 + size;
+  uint16_t *s1 = s0 + size;
+
+  for(long int i = 0; i <= t; i++)
+    r0[i] = g[i];
+
+  /*
+  ** r1 = a mod g.
+  */
+
+  long int da = polyDeg(a);
+
+  if(da < t)
+    for(long int i = 0; i <= da; i++)
+      r1[i] = a[i];
+  else
     {
-      int long k = static_cast<long int> (m_k);
+      x.assign(a.begin(), a.begin() + da + 1);
+      polyRem(x, g);
 
-      m_S.SetDims(k, k);
+      for(long int i = 0; i < t; i++)
+	r1[i] = x[i];
+    }
 
-      do
+  s1[0] = 1;
+
+  long int d1 = degree(r1, t);
+
+  while(d1 > 0)
+    {
+      long int ds = degree(s1, t);
+      uint16_t c = inv(r1[d1]);
+
+      for(long int d0 = degree(r0, t); d0 >= d1; d0--)
 	{
-	  for(long int i = 0; i < k; i++)
-	    m_S[i] = NTL::random_vec_GF2(k);
+	  if(!r0[d0])
+	    continue;
+
+	  long int j = d0 - d1;
+	  uint16_t q = mul(r0[d0], c);
+
+	  for(long int i = 0; i <= d1; i++)
+	    r0[i + j] ^= mul(q, r1[i]);
+
+	  for(long int i = 0; i <= ds && i + j <= t; i++)
+	    s0[i + j] ^= mul(q, s1[i]);
 	}
-      while(NTL::determinant(m_S) == 0);
 
-      m_Sinv = NTL::inv(m_S);
-    }
-  catch(...)
-    {
-      NTL::clear(m_S);
-      NTL::clear(m_Sinv);
-      m_ok = false;
-      return false;
+      std::swap(r0, r1);
+      std::swap(s0, s1);
+      d1 = degree(r1, t);
     }
 
-  m_ok &= true;
+  if(d1 < 0)
+    return false;
+
+  uint16_t c = inv(r1[0]);
+
+  x.resize(static_cast<size_t> (t));
+
+  for(long int i = 0; i < t; i++)
+    x[i] = mul(s1[i], c);
+
   return true;
 }
 
-bool mcnoodle_private_key::prepare_gZ(void)
+bool mcnoodle_gf2m::polyCoprime(const std::vector<uint16_t> &a,
+				const std::vector<uint16_t> &b) const
 {
-  try
-    {
-      NTL::GF2E::init
-	(NTL::BuildIrred_GF2X(static_cast<long int> (m_m))); /*
-							     ** Initialize
-							     ** some NTL
-							     ** internal
-							     ** object(s).
-							     */
-      m_gZ = NTL::BuildRandomIrred
-	(NTL::BuildIrred_GF2EX(static_cast<long int> (m_t)));
-    }
-  catch(...)
+  /*
+  ** Euclid, until a remainder is constant.
+  */
+
+  std::vector<uint16_t> r0(b);
+  std::vector<uint16_t> r1(a);
+
+  polyRem(r1, r0);
+
+  while(polyDeg(r1) > 0)
     {
-      NTL::clear(m_gZ);
-      m_ok = false;
-      return false;
+      polyRem(r0, r1);
+      r0.swap(r1);
     }
 
-  m_ok &= true;
-  return true;
+  return polyDeg(r1) == 0;
 }
 
-void mcnoodle_private_key::prepareSwappingColumns(void)
+bool mcnoodle_gf2m::polyIrreducible(const std::vector<uint16_t> &f) const
 {
-  m_swappingColumns.clear();
+  /*
+  ** Ben-Or: f of degree t is irreducible if gcd(X^(q^i) - X, f) = 1
+  ** for i <= t / 2, q = 2^m. Most reducible polynomials fail at a
+  ** small i. h -> h^q is m squarings modulo f. It is also linear
+  ** over GF(q), a product with the Frobenius powers (X^q)^j mod f,
+  ** j < t, whose computation costs about 2t / m steps of squarings.
+  ** Those are computed after t / 8 steps, when f is likely
+  ** irreducible. Products and reductions work on the logarithms of
+  ** the coefficients of f, which is monic, and of X^q.
+  */
 
-  long int n = static_cast<long int> (m_n);
+  long int t = polyDeg(f);
+
+  if(t < 1 || !m_ok || f[t] != 1)
+    return false;
+  else if(t == 1)
+    return true;
+  else if(!f[0])
+    return false;
+
+  /*
+  ** Zero coefficients of f, rare, are given the logarithm 2(2^m - 1),
+  ** the start of the zero period of the antilogarithms.
+  */
+
+  std::vector<size_t> logf(static_cast<size_t> (t));
+
+  for(long int k = 0; k < t; k++)
+    logf[k] = f[k] ? m_log[f[k]] : 2 * m_order;
+
+  std::vector<uint16_t> a(static_cast<size_t> (2 * t), 0);
+  std::vector<uint16_t> h(static_cast<size_t> (t), 0);
+
+  auto reduce = [&](uint16_t *x)
+    {
+      /*
+      ** x = a mod f, a of degree below 2t - 1.
+      */
+
+      for(long int i = 2 * t - 2; i >= t; i--)
+	if(a[i])
+	  {
+	    const uint16_t *z = &m_antilog[m_log[a[i]]];
+	    uint16_t *y = &a[i - t];
+
+	    for(long int k = 0; k < t; k++)
+	      y[k] ^= z[logf[k]];
+	  }
+
+      for(long int i = 0; i < t; i++)
+	x[i] = a[i];
+    };
+
+  auto coprime = [&](void)
+    {
+      h[1] ^= 1;
+
+      bool coprime = polyCoprime(h, f);
+
+      h[1] ^= 1;
+      return coprime;
+    };
+
+  long int i = 1;
+  long int steps = std::max(2L, t / s_frobeniusDivisor);
+  std::vector<uint16_t> Xq;
+
+  h[1] = 1;
+
+  for(; i <= t / 2 && i <= steps; i++)
+    {
+      for(size_t j = 0; j < m_m; j++)
+	{
+	  for(long int k = 0; k < t; k++)
+	    {
+	      a[2 * k] = sq(h[k]);
+	      a[2 * k + 1] = 0;
+	    }
+
+	  reduce(&h[0]);
+	}
+
+      if(i == 1)
+	Xq = h;
+
+      if(!coprime())
+	return false;
+    }
+
+  if(i > t / 2)
+    return true;
+
+  /*
+  ** Row j of R is (X^q)^j mod f, kept as logarithms.
+  */
+
+  std::vector<size_t> R(static_cast<size_t> (t * t), 2 * m_order);
+  std::vector<uint16_t> r(static_cast<size_t> (t), 0);
+
+  r[0] = 1;
+
+  for(long int j = 0; j < t; j++)
+    {
+      size_t *l = &R[static_cast<size_t> (j * t)];
+
+      for(long int k = 0; k < t; k++)
+	if(r[k])
+	  l[k] = m_log[r[k]];
+
+      if(j == t - 1)
+	break;
+
+      std::fill(a.begin(), a.end(), 0);
+
+      for(long int k = 0; k < t; k++)
+	if(Xq[k])
+	  {
+	    const uint16_t *z = &m_antilog[m_log[Xq[k]]];
+	    uint16_t *y = &a[k];
+
+	    for(long int n = 0; n < t; n++)
+	      y[n] ^= z[l[n]];
+	  }
+
+      reduce(&r[0]);
+    }
+
+  for(; i <= t / 2; i++)
+    {
+      std::fill(a.begin(), a.end(), 0);
+
+      for(long int j = 0; j < t; j++)
+	if(h[j])
+	  {
+	    const size_t *l = &R[static_cast<size_t> (j * t)];
+	    const uint16_t *z = &m_antilog[m_log[h[j]]];
+
+	    for(long int k = 0; k < t; k++)
+	      a[k] ^= z[l[k]];
+	  }
+
+      for(long int k = 0; k < t; k++)
+	h[k] = a[k];
+
+      if(!coprime())
+	return false;
+    }
+
+  return true;
+}
+
+bool mcnoodle_gf2m::polyRandomIrreducible(std::vector<uint16_t> &g,
+					  const size_t t,
+					  NTL::RandomStream &stream,
+					  size_t &attempts) const
+{
+  /*
+  ** Uniform monic polynomials of degree t from stream until one is
+  ** irreducible. About one in t is. attempts counts the draws.
+  */
+
+  attempts = 0;
+
+  if(!m_ok || t < 1)
+    return false;
+
+  std::vector<unsigned char> bytes(2 * t);
+  uint16_t mask = static_cast<uint16_t> (m_order);
+
+  g.resize(t + 1);
+
+  do
+    {
+      attempts += 1;
+      stream.get(&bytes[0], static_cast<long int> (bytes.size()));
+
+      for(size_t i = 0; i < t; i++)
+	g[i] = static_cast<uint16_t>
+	  ((bytes[2 * i] | (bytes[2 * i + 1] << CHAR_BIT)) & mask);
+
+      g[t] = 1;
+    }
+  while(!polyIrreducible(g));
+
+  return true;
+}
+
+bool mcnoodle_gf2m::prepare(const NTL::GF2X &modulus)
+{
+  m_ok = false;
+
+  long int m = NTL::deg(modulus);
+
+  if(m < 2 || m > 16)
+    return false;
+
+  m_m = static_cast<size_t> (m);
+  m_modulus = 0;
+  m_order = (static_cast<size_t> (1) << m_m) - 1;
+
+  for(long int i = 0; i <= m; i++)
+    if(NTL::IsOne(NTL::coeff(modulus, i)))
+      m_modulus |= static_cast<uint32_t> (1) << i;
+
+  m_antilog.assign(3 * m_order, 0);
+  m_log.assign(m_order + 1, 0);
+
+  /*
+  ** The modulus is irreducible, but not necessarily primitive. An
+  ** element g is primitive if g^(order / p) != 1 for every prime p
+  ** dividing the order 2^m - 1.
+  */
+
+  std::vector<size_t> primes;
+  size_t order = m_order;
+
+  for(size_t p = 2; p * p <= order; p++)
+    if(order % p == 0)
+      {
+	primes.push_back(p);
+
+	while(order % p == 0)
+	  order /= p;
+      }
+
+  if(order > 1)
+    primes.push_back(order);
+
+  uint32_t g = 2;
+
+  for(; g <= static_cast<uint32_t> (m_order); g++)
+    {
+      bool primitive = true;
+
+      for(size_t i = 0; i < primes.size() && primitive; i++)
+	{
+	  size_t e = m_order / primes[i];
+	  uint32_t a = 1;
+	  uint32_t b = g;
+
+	  for(; e > 0; e >>= 1)
+	    {
+	      if(e & 1)
+		a = mulSlow(a, b);
+
+	      b = mulSlow(b, b);
+	    }
+
+	  primitive = a != 1;
+	}
+
+      if(primitive)
+	break;
+    }
+
+  if(g > static_cast<uint32_t> (m_order))
+    return false;
+
+  for(size_t i = 0, a = 1; i < m_order; i++)
+    {
+      m_antilog[i] = static_cast<uint16_t> (a);
+      m_log[a] = static_cast<uint16_t> (i);
+      a = mulSlow(static_cast<uint32_t> (a), g);
+    }
+
+  m_ok = true;
+
+  for(size_t i = 0; i < m_order; i++)
+    m_antilog[i + m_order] = m_antilog[i];
+
+  return true;
+}
+
+long int mcnoodle_gf2m::degree(const uint16_t *a, const long int n)
+{
+  for(long int i = n; i >= 0; i--)
+    if(a[i])
+      return i;
+
+  return -1;
+}
+
+long int mcnoodle_gf2m::polyDeg(const std::vector<uint16_t> &a)
+{
+  return a.empty() ? -1 : degree(&a[0], static_cast<long int> (a.size()) - 1);
+}
+
+uint16_t mcnoodle_gf2m::polyEval(const std::vector<uint16_t> &f,
+				 const uint16_t x) const
+{
+  uint16_t y = 0;
+
+  for(long int i = polyDeg(f); i >= 0; i--)
+    y = static_cast<uint16_t> (mul(y, x) ^ f[i]);
+
+  return y;
+}
+
+size_t mcnoodle_gf2m::fftScratchSize(const long int df, const size_t d)
+{
+  if(df <= 0 || d == 0)
+    return 0;
+
+  return 2 * static_cast<size_t> (df / 2 + 1) + 2 * (d - 1) +
+    (static_cast<size_t> (1) << (d - 1)) + fftScratchSize(df / 2, d - 1);
+}
+
+void mcnoodle_gf2m::fft(uint16_t *y,
+			uint16_t *f,
+			const long int df,
+			const uint16_t *beta,
+			const size_t d,
+			uint16_t *scratch) const
+{
+  /*
+  ** Gao-Mateer additive FFT. Evaluates f, of degree df, at every
+  ** element of span(beta[0], ..., beta[d - 1]); y[j] is the value
+  ** at the point whose coordinates are the bits of j. f is
+  ** destroyed. scratch holds fftScratchSize(df, d) elements.
+  */
+
+  size_t count = static_cast<size_t> (1) << d;
+
+  if(df <= 0 || d == 0)
+    {
+      uint16_t c = df >= 0 ? f[0] : 0;
+
+      for(size_t i = 0; i < count; i++)
+	y[i] = c;
+
+      return;
+    }
+
+  /*
+  ** Twist, g(x) = f(beta[d - 1] * x), so that the last basis
+  ** element becomes 1.
+  */
+
+  uint16_t b = beta[d - 1];
+  uint16_t bi = 1;
+
+  for(long int i = 0; i <= df; i++)
+    {
+      f[i] = mul(f[i], bi);
+      bi = mul(bi, b);
+    }
+
+  /*
+  ** Radix conversion, g(x) = g0(x^2 + x) + x * g1(x^2 + x).
+  ** Repeated division by x^2 + x, the remainders providing the
+  ** coefficients of g0 and g1.
+  */
+
+  long int dg = df / 2;
+  size_t half = count / 2;
+  uint16_t *g0 = scratch;
+  uint16_t *g1 = g0 + dg + 1;
+  uint16_t *gamma = g1 + dg + 1;
+  uint16_t *delta = gamma + d - 1;
+  uint16_t *v = delta + d - 1;
+
+  scratch = v + half;
+
+  for(long int i = 0, h = df; i <= dg; i++, h -= 2)
+    {
+      for(long int k = h; k >= 2; k--)
+	f[k - 1] ^= f[k];
+
+      g0[i] = h >= 0 ? f[0] : 0;
+      g1[i] = h >= 1 ? f[1] : 0;
+
+      for(long int k = 2; k <= h; k++)
+	f[k - 2] = f[k];
+    }
+
+  b = inv(b);
+
+  for(size_t i = 0; i < d - 1; i++)
+    {
+      gamma[i] = mul(beta[i], b);
+      delta[i] = static_cast<uint16_t> (sq(gamma[i]) ^ gamma[i]);
+    }
+
+  fft(y, g0, degree(g0, dg), delta, d - 1, scratch);
+  fft(v, g1, degree(g1, dg), delta, d - 1, scratch);
+
+  /*
+  ** alpha runs through span(gamma) in the order of j. The point
+  ** alpha^2 + alpha has the same coordinates j in span(delta).
+  */
+
+  uint16_t alpha = 0;
+
+  for(size_t j = 0; j < half; j++)
+    {
+      if(j > 0)
+	{
+	  size_t i = 0;
+
+	  while(!((j >> i) & 1))
+	    i++;
+
+	  alpha = static_cast<uint16_t> (alpha ^ gamma[i]);
+
+	  for(size_t k = 0; k < i; k++)
+	    alpha = static_cast<uint16_t> (alpha ^ gamma[k]);
+	}
+
+      uint16_t w = static_cast<uint16_t> (y[j] ^ mul(alpha, v[j]));
+
+      y[j] = w;
+      y[j + half] = static_cast<uint16_t> (w ^ v[j]);
+    }
+}
+
+uint32_t mcnoodle_gf2m::mulSlow(const uint32_t a, const uint32_t b) const
+{
+  uint32_t c = 0;
+
+  for(size_t i = 0; i < m_m; i++)
+    if((b >> i) & 1)
+      c ^= a << i;
+
+  for(long int i = 2 * static_cast<long int> (m_m) - 2;
+      i >= static_cast<long int> (m_m); i--)
+    if((c >> i) & 1)
+      c ^= m_modulus << (i - static_cast<long int> (m_m));
+
+  return c;
+}
+
+void mcnoodle_gf2m::polyEvalFFT(std::vector<uint16_t> &y,
+				 const std::vector<uint16_t> &f) const
+{
+  std::vector<uint16_t> scratch;
+
+  polyEvalFFT(y, f, scratch);
+}
+
+void mcnoodle_gf2m::polyEvalFFT(std::vector<uint16_t> &y,
+				 const std::vector<uint16_t> &f,
+				 std::vector<uint16_t> &scratch) const
+{
+  y.resize(m_order + 1);
+  scratch.resize(evalFFTScratchSize(polyDeg(f)));
+  evalFFT(&y[0], f, &scratch[0]);
+}
+
+void mcnoodle_gf2m::evalFFT(uint16_t *y,
+			    const std::vector<uint16_t> &f,
+			    uint16_t *scratch) const
+{
+  /*
+  ** y[x] = f(x) for every x in GF(2^m), over the polynomial basis.
+  ** scratch holds evalFFTScratchSize(deg(f)) elements.
+  */
+
+  long int df = polyDeg(f);
+  uint16_t *basis = scratch;
+  uint16_t *g = basis + m_m;
+
+  for(size_t i = 0; i < m_m; i++)
+    basis[i] = static_cast<uint16_t> (1 << i);
+
+  for(long int i = 0; i <= df; i++)
+    g[i] = f[i];
+
+  fft(y, g, df, basis, m_m, g + std::max(df + 1, 1L));
+}
+
+size_t mcnoodle_gf2m::evalFFTScratchSize(const long int df) const
+{
+  return m_m + static_cast<size_t> (std::max(df + 1, 1L)) +
+    fftScratchSize(df, m_m);
+}
+
+void mcnoodle_gf2m::polyEvalSupport(std::vector<uint16_t> &y,
+				     const std::vector<uint16_t> &f,
+				     const std::vector<uint16_t> &L) const
+{
+  std::vector<uint16_t> scratch;
+
+  polyEvalSupport(y, f, L, scratch);
+}
+
+void mcnoodle_gf2m::polyEvalSupport(std::vector<uint16_t> &y,
+				     const std::vector<uint16_t> &f,
+				     const std::vector<uint16_t> &L,
+				     std::vector<uint16_t> &scratch) const
+{
+  /*
+  ** y[i] = f(L[i]). The support is L[0] = 0 and L[i] = L[1]^i, as
+  ** prepared by mcnoodle_field_context. The additive FFT evaluates f
+  ** over the whole field. It was faster than a Chien search over
+  ** the support for every m from 10 to 13 and every degree from 1
+  ** to 38.
+  */
+
+  long int df = polyDeg(f);
+  size_t n = L.size();
+
+  if(n < 2)
+    {
+      y.assign(n, polyEval(f, 0));
+      return;
+    }
+
+  scratch.resize(m_order + 1 + evalFFTScratchSize(df));
+  evalFFT(&scratch[0], f, &scratch[m_order + 1]);
+  y.resize(n);
+
+  const uint16_t *z = &scratch[0];
+
+  for(size_t i = 0; i < n; i++)
+    y[i] = z[L[i]];
+}
+
+void mcnoodle_gf2m::polyRem(std::vector<uint16_t> &a,
+			    const std::vector<uint16_t> &g) const
+{
+  long int dg = polyDeg(g);
+
+  if(dg < 0)
+    return;
+
+  uint16_t c = inv(g[dg]);
+
+  for(long int i = polyDeg(a); i >= dg; i--)
+    {
+      if(!a[i])
+	continue;
+
+      long int j = i - dg;
+      uint16_t q = mul(a[i], c);
+
+      for(long int k = 0; k <= dg; k++)
+	a[j + k] ^= mul(q, g[k]);
+    }
+
+  a.resize(static_cast<size_t> (dg), 0);
+}
+
+void mcnoodle_gf2m::polySqrMod(std::vector<uint16_t> &x,
+			       const std::vector<uint16_t> &a,
+			       const std::vector<uint16_t> &g) const
+{
+  long int da = polyDeg(a);
+
+  x.assign(static_cast<size_t> (std::max(2 * da + 1, 1L)), 0);
+
+  for(long int i = 0; i <= da; i++)
+    x[2 * i] = sq(a[i]);
+
+  polyRem(x, g);
+}
+
+void mcnoodle_gf2m::polySqrtMod(std::vector<uint16_t> &x,
+				 const std::vector<uint16_t> &a,
+				 const std::vector<uint16_t> &g,
+				 const std::vector<uint16_t> &sqrtZ) const
+{
+  std::vector<uint16_t> scratch;
+
+  polySqrtMod(x, a, g, sqrtZ, scratch);
+}
+
+void mcnoodle_gf2m::polySqrtMod(std::vector<uint16_t> &x,
+				 const std::vector<uint16_t> &a,
+				 const std::vector<uint16_t> &g,
+				 const std::vector<uint16_t> &sqrtZ,
+				 std::vector<uint16_t> &scratch) const
+{
+  /*
+  ** a = a0(z)^2 + z * a1(z)^2, so sqrt(a) = a0(z) + sqrt(z) * a1(z).
+  ** The coefficients of a0 and a1 are the square roots of the even
+  ** and odd coefficients of a.
+  */
+
+  long int da = polyDeg(a);
+  long int dz = polyDeg(sqrtZ);
+  long int h = std::max(da / 2, 0L);
+
+  scratch.assign(static_cast<size_t> (h + 1), 0);
+
+  uint16_t *a1 = &scratch[0];
+
+  for(long int i = 1; i <= da; i += 2)
+    a1[i / 2] = sqrt(a[i]);
+
+  x.assign(static_cast<size_t> (h + std::max(dz, 0L) + 1), 0);
+
+  for(long int i = 0; i <= h; i++)
+    if(a1[i])
+      for(long int j = 0; j <= dz; j++)
+	x[i + j] ^= mul(a1[i], sqrtZ[j]);
+
+  for(long int i = 0; i <= da; i += 2)
+    x[i / 2] ^= sqrt(a[i]);
+
+  polyRem(x, g);
+}
+
+mcnoodle_field_context::mcnoodle_field_context(void)
+{
+}
+
+mcnoodle_field_context::~mcnoodle_field_context()
+{
+}
+
+const mcnoodle_field_context *mcnoodle_field_context::get(const size_t m)
+{
+  if(m < 2 || m > 16)
+    return 0;
+
+  std::lock_guard<std::mutex> lock(s_ntlMutex);
+
+  if(!s_fieldContexts[m])
+    {
+      mcnoodle_field_context *context = new (std::nothrow)
+	mcnoodle_field_context();
+
+      if(!context)
+	return 0;
+      else if(!context->prepare(m))
+	{
+	  delete context;
+	  return 0;
+	}
+
+      s_fieldContexts[m] = context; // Kept for the life of the process.
+    }
+
+  return s_fieldContexts[m];
+}
+
+bool mcnoodle_field_context::prepare(const size_t m)
+{
+  try
+    {
+      m_modulus = NTL::BuildIrred_GF2X(static_cast<long int> (m));
+
+      if(!m_field.prepare(m_modulus))
+	return false;
+
+      size_t n = static_cast<size_t> (1) << m;
+
+      m_L.resize(n);
+      m_L[0] = 0; // Lambda-0 is always zero.
+      m_L[1] = m_field.primitive();
+
+      for(size_t i = 2; i < n; i++)
+	m_L[i] = m_field.mul(m_L[1], m_L[i - 1]);
+    }
+  catch(...)
+    {
+      m_L.clear();
+      return false;
+    }
+
+  return true;
+}
+
+mcnoodle_permutation::mcnoodle_permutation(void)
+{
+}
+
+mcnoodle_permutation::~mcnoodle_permutation()
+{
+}
+
+bool mcnoodle_permutation::prepare(const size_t n,
+				   NTL::RandomStream &stream)
+{
+  /*
+  ** Fisher-Yates over a caller's stream.
+  */
+
+  try
+    {
+      m_forward.resize(n);
+      m_inverse.resize(n);
+
+      for(size_t i = 0; i < n; i++)
+	m_forward[i] = static_cast<uint32_t> (i);
+
+      for(size_t i = n; i > 1; i--)
+	{
+	  size_t j = static_cast<size_t>
+	    (randomBnd(stream, static_cast<long int> (i)));
+
+	  std::swap(m_forward[i - 1], m_forward[j]);
+	}
+
+      for(size_t i = 0; i < n; i++)
+	m_inverse[m_forward[i]] = static_cast<uint32_t> (i);
+    }
+  catch(...)
+    {
+      m_forward.clear();
+      m_inverse.clear();
+      return false;
+    }
+
+  return true;
+}
+
+bool mcnoodle_permutation::prepare(const std::vector<uint32_t> &forward)
+{
+  try
+    {
+      m_forward = forward;
+      m_inverse.assign(forward.size(), static_cast<uint32_t> (forward.size()));
+
+      for(size_t i = 0; i < forward.size(); i++)
+	{
+	  if(forward[i] >= forward.size() ||
+	     m_inverse[forward[i]] != forward.size())
+	    throw std::exception(); // Not a permutation.
+
+	  m_inverse[forward[i]] = static_cast<uint32_t> (i);
+	}
+    }
+  catch(...)
+    {
+      m_forward.clear();
+      m_inverse.clear();
+      return false;
+    }
+
+  return true;
+}
+
+void mcnoodle_permutation::apply(NTL::vec_GF2 &x,
+				 const NTL::vec_GF2 &a) const
+{
+  /*
+  ** x = a * P, x[forward[i]] = a[i].
+  */
+
+  long int n = static_cast<long int> (m_forward.size());
+
+  if(a.length() != n)
+    throw std::exception();
+
+  x.SetLength(n);
+  gatherBits(x.rep.elts(), a.rep.elts(), &m_inverse[0], m_inverse.size());
+}
+
+void mcnoodle_permutation::applyColumns(NTL::mat_GF2 &X,
+					const NTL::mat_GF2 &A) const
+{
+  /*
+  ** X = A * P, a column gather.
+  */
+
+  long int n = static_cast<long int> (m_forward.size());
+
+  if(A.NumCols() != n)
+    throw std::exception();
+
+  X.SetDims(A.NumRows(), n);
+
+  for(long int i = 0; i < A.NumRows(); i++)
+    gatherBits(X[i].rep.elts(),
+	       A[i].rep.elts(),
+	       &m_inverse[0],
+	       m_inverse.size());
+}
+
+void mcnoodle_permutation::applyInverse(NTL::vec_GF2 &x,
+					const NTL::vec_GF2 &a) const
+{
+  /*
+  ** x = a * P^-1 = a * P^T, x[i] = a[forward[i]].
+  */
+
+  long int n = static_cast<long int> (m_forward.size());
+
+  if(a.length() != n)
+    throw std::exception();
+
+  x.SetLength(n);
+  gatherBits(x.rep.elts(), a.rep.elts(), &m_forward[0], m_forward.size());
+}
+
+mcnoodle_decrypt_workspace::mcnoodle_decrypt_workspace(void)
+{
+}
+
+mcnoodle_decrypt_workspace::~mcnoodle_decrypt_workspace()
+{
+}
+
+bool mcnoodle_decrypt_workspace::correct(const mcnoodle_gf2m &field,
+					 const std::vector<uint16_t> &gZ,
+					 const std::vector<uint16_t> &sqrtZ,
+					 const std::vector<uint16_t> &L,
+					 const uint64_t *v,
+					 const size_t stride,
+					 const size_t size,
+					 const size_t errors)
+{
+  /*
+  ** Patterson, over the field's tables. Corrects m_ccar in place.
+  */
+
+  NTL::vec_GF2 &ccar(m_ccar);
+  long int n = static_cast<long int> (size);
+  long int t = static_cast<long int> (errors);
+  std::vector<uint16_t> &sigma(m_sigma);
+  std::vector<uint16_t> &syndrome(m_syndrome);
+  std::vector<uint64_t> &words(m_words);
+
+  sigma.clear();
+  syndrome.assign(static_cast<size_t> (t), 0);
+  words.assign(stride, 0);
+
+  /*
+  ** Accumulate the table rows of the set bits of ccar, a word
+  ** of ccar and four coefficients at a time.
+  */
+
+  const _ntl_ulong *cp = ccar.rep.elts();
+
+  for(long int i = 0; i < ccar.rep.length(); i++)
+    {
+      _ntl_ulong w = cp[i];
+
+      for(long int j = i * NTL_BITS_PER_LONG; w != 0 && j < n; j++)
+	{
+	  if(w & 1)
+	    {
+	      const uint64_t *row = v + static_cast<size_t> (j) * stride;
+
+	      for(size_t k = 0; k < stride; k++)
+		words[k] ^= row[k];
+	    }
+
+	  w >>= 1;
+	}
+    }
+
+  for(long int j = 0; j < t; j++)
+    syndrome[j] = static_cast<uint16_t> (words[j / 4] >> (16 * (j % 4)));
+
+  if(mcnoodle_gf2m::polyDeg(syndrome) >= 0)
+    {
+      std::vector<uint16_t> &T(m_T);
+
+      if(!field.polyInvMod(T, syndrome, gZ, m_scratch))
+	return false;
+
+      T[1] ^= 1; // T + X.
+
+      if(mcnoodle_gf2m::polyDeg(T) < 0)
+	{
+	  sigma.assign(2, 0);
+	  sigma[1] = 1; // X.
+	}
+      else
+	{
+	  /*
+	  ** tau = sqrt(T) mod g(z).
+	  */
+
+	  std::vector<uint16_t> &tau(m_tau);
+
+	  field.polySqrtMod
+	    (tau, T, gZ, sqrtZ, m_scratch);
+
+	  std::vector<uint16_t> &r0(m_r0);
+	  std::vector<uint16_t> &r1(m_r1);
+	  std::vector<uint16_t> &u0(m_u0);
+	  std::vector<uint16_t> &u1(m_u1);
+
+	  r0.assign(gZ.begin(), gZ.end());
+	  r1.assign(tau.begin(), tau.end());
+	  u0.assign(static_cast<size_t> (t + 1), 0);
+	  u1.assign(static_cast<size_t> (t + 1), 0);
+
+	  long int dr = mcnoodle_gf2m::polyDeg(r1);
+	  long int dt = mcnoodle_gf2m::polyDeg(r0) - dr;
+	  long int du = 0;
+	  long int t2 = t / 2;
+
+	  r0.resize(static_cast<size_t> (t + 1), 0);
+	  r1.resize(static_cast<size_t> (t + 1), 0);
+	  u1[0] = 1;
+
+	  while(dr >= t2 + 1)
+	    {
+	      uint16_t c2 = field.inv(r1[dr]);
+
+	      for(long int j = dt; j >= 0; j--)
+		{
+		  uint16_t c1 = field.mul(r0[dr + j], c2);
+
+		  if(c1)
+		    {
+		      for(long int i = 0; i <= du && i + j <= t; i++)
+			u0[i + j] ^= field.mul(c1, u1[i]);
+
+		      for(long int i = 0; i <= dr; i++)
+			r0[i + j] ^= field.mul(c1, r1[i]);
+		    }
+		}
+
+	      r0.swap(r1);
+	      u0.swap(u1);
+	      du = du + dt;
+	      dt = 1;
+
+	      while(dr - dt >= 0 && !r1[dr - dt])
+		dt++;
+
+	      dr -= dt;
+
+	      if(dr < 0) // A zero remainder, not a valid codeword.
+		break;
+	    }
+
+	  /*
+	  ** sigma = alpha^2 + gamma^2 * X, alpha = r1 and gamma = u1.
+	  */
+
+	  sigma.assign(static_cast<size_t> (2 * t + 2), 0);
+
+	  for(long int i = 0; i <= t; i++)
+	    {
+	      if(2 * i < static_cast<long int> (sigma.size()))
+		sigma[2 * i] ^= field.sq(r1[i]);
+
+	      if(2 * i + 1 < static_cast<long int> (sigma.size()))
+		sigma[2 * i + 1] ^= field.sq(u1[i]);
+	    }
+	}
+    }
+
+  /*
+  ** Flip the bits of ccar at the roots of sigma.
+  */
+
+  std::vector<uint16_t> &y(m_y);
+
+  field.polyEvalSupport
+    (y, sigma, L, m_scratch);
+
+  _ntl_ulong *ep = ccar.rep.elts();
+
+  for(long int i = 0; i < n; i++)
+    if(y[i] == 0)
+      ep[i / NTL_BITS_PER_LONG] ^=
+	static_cast<_ntl_ulong> (1) << (i % NTL_BITS_PER_LONG);
+
+  return true;
+}
+
+mcnoodle_private_key::mcnoodle_private_key(const size_t m, const size_t t)
+{
+  m_k = 0;
+  m_m = mcnoodle::minimumM(m);
+  m_context = mcnoodle_field_context::get(m_m);
+  m_gZAttempts = 0;
+  m_n = 1 << m_m; // 2^m
+  m_ok = m_context != 0;
+  m_preSynTabStride = 0;
+  m_t = mcnoodle::minimumT(t);
+
+  /*
+  ** Some calculations.
+  */
+
+  m_k = m_n - m_m * m_t;
+
+  /*
+  ** The containers are prepared in stages, see
+  ** mcnoodle::generatePrivatePublicKeys().
+  */
+}
+
+mcnoodle_private_key::~mcnoodle_private_key()
+{
+}
+
+bool mcnoodle_private_key::prepareG(const NTL::mat_GF2 &H)
+{
+  /*
+  ** H is in reduced row echelon form, with the identity of row i
+  ** in column swappingColumns()[i], i < n - k. Row j of G has a one
+  ** in the free column c = swappingColumns()[n - k + j] and H[i][c]
+  ** in the identity column of row i. Row j of R is therefore column
+  ** c of H, and R is the transpose of the free columns of H.
+  */
+
+  try
+    {
+      long int k = static_cast<long int> (m_k);
+      long int n = static_cast<long int> (m_n);
+      long int r = n - k;
+
+      if(H.NumCols() != n || H.NumRows() != r ||
+	 m_swappingColumns.size() != static_cast<size_t> (n))
+	throw std::exception();
+
+      NTL::mat_GF2 F;
+      std::vector<uint32_t> free(m_swappingColumns.begin() + r,
+				 m_swappingColumns.end());
+
+      F.SetDims(r, k);
+
+      for(long int i = 0; i < r; i++)
+	gatherBits(F[i].rep.elts(), H[i].rep.elts(), &free[0], m_k);
+
+      NTL::transpose(m_R, F);
+    }
+  catch(...)
+    {
+      m_R.kill();
+      m_ok = false;
+      return false;
+    }
+
+  m_ok &= true;
+  return true;
+}
+
+bool mcnoodle_private_key::prepareGoppaCode(NTL::RandomStream &stream)
+{
+  /*
+  ** g(z) and sqrt(z) over the shared field context, which also
+  ** supplies the support L. Only the field's tables and stream are
+  ** used, so no lock is needed.
+  */
+
+  if(!prepare_gZ(stream) || !prepareSqrtZ())
+    return false;
+
+  m_ok &= true;
+  return true;
+}
+
+bool mcnoodle_private_key::prepareMessageColumns
+(const mcnoodle_permutation &Q)
+{
+  /*
+  ** The message occupies the public positions Q.forward()[i],
+  ** i < k, which are the private positions P.inverse()[...].
+  */
+
+  try
+    {
+      if(Q.size() != m_n || m_P.size() != m_n)
+	throw std::exception();
+
+      m_messageColumns.resize(m_k);
+
+      for(size_t i = 0; i < m_k; i++)
+	m_messageColumns[i] = m_P.inverse()[Q.forward()[i]];
+    }
+  catch(...)
+    {
+      m_messageColumns.clear();
+      m_ok = false;
+      return false;
+    }
+
+  m_ok &= true;
+  return true;
+}
+
+bool mcnoodle_private_key::prepareP(NTL::RandomStream &stream)
+{
+  /*
+  ** A permutation matrix always has an inverse, its transpose.
+  ** Neither is ever formed, P is kept as an index permutation.
+  */
+
+  return m_P.prepare(m_n, stream);
+}
+
+bool mcnoodle_private_key::preparePreSynTab(const size_t threads)
+{
+  try
+    {
+      if(!m_context || m_gZ16.size() < 2 || !field().ok())
+	return false;
+
+      /*
+      ** One contiguous table, rows padded to whole cache lines. The
+      ** extra line leaves room to align the first row.
+      */
+
+      m_preSynTabStride = (m_t + 3) / 4;
+      m_preSynTabStride = 8 * ((m_preSynTabStride + 7) / 8);
+      m_preSynTab.assign(m_n * m_preSynTabStride + 8, 0);
+
+      /*
+      ** g(z) - g(a) = (z - a) * q(z), so that 1 / (z - a) is q(z) *
+      ** g(a)^-1 mod g(z). g(z) is irreducible of degree t > 1 and has
+      ** no roots, and the whole support is evaluated at once. The
+      ** inverses of the field are table lookups, so they need no
+      ** batching.
+      */
+
+      const mcnoodle_gf2m &f(field());
+      const std::vector<uint16_t> &g(m_gZ16);
+      const std::vector<uint16_t> &support(L());
+      std::atomic<size_t> next(0);
+      std::vector<uint16_t> ga;
+      uint64_t *table = &m_preSynTab[0];
+
+      table += (64 - reinterpret_cast<uintptr_t> (table) % 64) % 64 /
+	sizeof(*table);
+      f.polyEvalSupport(ga, g, support);
+
+      for(size_t i = 0; i < m_n; i++)
+	if(ga[i] == 0)
+	  throw std::exception();
+
+      auto work = [&](void)
+	{
+	  for(;;)
+	    {
+	      size_t i0 = next.fetch_add(s_preSynTabRows);
+
+	      if(i0 >= m_n)
+		break;
+
+	      for(size_t i = i0; i < std::min(m_n, i0 + s_preSynTabRows); i++)
+		{
+		  /*
+		  ** Synthetic division, q[j - 1] = g[j] + a * q[j] from
+		  ** q[t - 1] = g[t], each q[j] scaled as it is found.
+		  */
+
+		  uint16_t a = support[i];
+		  uint16_t c = f.inv(ga[i]);
+		  uint16_t q = g[m_t];
+		  uint64_t *row = table + i * m_preSynTabStride;
+
+		  for(size_t j = m_t; j-- > 0;)
+		    {
+		      row[j / 4] |= static_cast<uint64_t> (f.mul(q, c)) <<
+			(16 * (j % 4));
+
+		      if(j > 0)
+			q = g[j] ^ f.mul(a, q);
+		    }
+		}
+	    }
+	};
+
+      runWorkers(threads, m_n / s_preSynTabRows, work);
+    }
+  catch(...)
+    {
+      m_preSynTab.clear();
+      return false;
+    }
+
+  return true;
+}
+
+bool mcnoodle_private_key::prepareS(NTL::RandomStream &stream,
+				    const size_t blockRows)
+{
+  /*
+  ** S = Pi * L * U, Pi a random row permutation and L and U random
+  ** unit lower and unit upper triangular matrices. Every such
+  ** product is invertible and Sinv = U^-1 * L^-1 * Pi^T comes from
+  ** the same factors, so there is neither a determinant test nor a
+  ** retry. The triangular inverses are found by substitution and
+  ** the products by the Four Russians, blockRows rows at a time.
+  ** Each factor is released once it is consumed, so that no more
+  ** than four k x k matrices are held at once.
+  */
+
+  try
+    {
+      long int k = static_cast<long int> (m_k);
+      mcnoodle_permutation pi;
+      size_t block = std::max(static_cast<size_t> (1),
+			      std::min(blockRows, m_k));
+      size_t bytes = (m_k + CHAR_BIT - 1) / CHAR_BIT;
+      size_t kw = (m_k + NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG;
+      std::vector<unsigned char> row(bytes);
+      NTL::mat_GF2 L;
+      NTL::mat_GF2 Linv;
+      NTL::mat_GF2 U;
+      NTL::mat_GF2 Uinv;
+      NTL::mat_GF2 Y;
+
+      if(!pi.prepare(m_k, stream))
+	throw std::exception();
+
+      L.SetDims(k, k);
+      U.SetDims(k, k);
+
+      for(size_t i = 0; i < m_k; i++)
+	{
+	  /*
+	  ** Row i of L keeps the random bits below i and row i of U
+	  ** those above i. Both have a one at i.
+	  */
+
+	  size_t w = i / NTL_BITS_PER_LONG;
+	  _ntl_ulong bit = static_cast<_ntl_ulong> (1) <<
+	    (i % NTL_BITS_PER_LONG);
+	  _ntl_ulong *l = L[static_cast<long int> (i)].rep.elts();
+	  _ntl_ulong *u = U[static_cast<long int> (i)].rep.elts();
+
+	  stream.get(&row[0], static_cast<long int> (bytes));
+	  packBytes(l, &row[0], bytes);
+	  l[w] &= bit - 1;
+
+	  for(size_t j = w + 1; j < kw; j++)
+	    l[j] = 0;
+
+	  l[w] |= bit;
+	  stream.get(&row[0], static_cast<long int> (bytes));
+	  packBytes(u, &row[0], bytes);
+	  u[w] &= ~(bit - 1);
+
+	  for(size_t j = 0; j < w; j++)
+	    u[j] = 0;
+
+	  if(m_k % NTL_BITS_PER_LONG != 0)
+	    u[kw - 1] &= (static_cast<_ntl_ulong> (1) <<
+			  (m_k % NTL_BITS_PER_LONG)) - 1;
+
+	  u[w] |= bit;
+	}
+
+      /*
+      ** L^-1: row i is e_i plus the rows j < i of L^-1 selected by
+      ** row i of L. Row j of L^-1 lives in its first j + 1 bits.
+      */
+
+      Linv.SetDims(k, k);
+
+      for(size_t i = 0; i < m_k; i++)
+	{
+	  _ntl_ulong *x = Linv[static_cast<long int> (i)].rep.elts();
+	  const _ntl_ulong *l = L[static_cast<long int> (i)].rep.elts();
+
+	  for(size_t j = 0; j < i; j++)
+	    if((l[j / NTL_BITS_PER_LONG] >> (j % NTL_BITS_PER_LONG)) & 1)
+	      {
+		const _ntl_ulong *y = Linv[static_cast<long int> (j)].
+		  rep.elts();
+
+		for(size_t w = 0; w <= j / NTL_BITS_PER_LONG; w++)
+		  x[w] ^= y[w];
+	      }
+
+	  x[i / NTL_BITS_PER_LONG] ^= static_cast<_ntl_ulong> (1) <<
+	    (i % NTL_BITS_PER_LONG);
+	}
+
+      /*
+      ** Row pi(i) of L * U is row i of S.
+      */
+
+      m_S.SetDims(k, k);
+
+      for(size_t i0 = 0; i0 < m_k; i0 += block)
+	{
+	  size_t rows = std::min(block, m_k - i0);
+
+	  mulRows(Y, L, i0, rows, U);
+
+	  for(size_t i = 0; i < rows; i++)
+	    m_S[static_cast<long int> (pi.inverse()[i0 + i])] =
+	      Y[static_cast<long int> (i)];
+	}
+
+      L.kill();
+
+      /*
+      ** U^-1: row i is e_i plus the rows j > i of U^-1 selected by
+      ** row i of U. Row j of U^-1 lives in its bits from j on.
+      */
+
+      Uinv.SetDims(k, k);
+
+      for(size_t i = m_k; i-- > 0;)
+	{
+	  _ntl_ulong *x = Uinv[static_cast<long int> (i)].rep.elts();
+	  const _ntl_ulong *u = U[static_cast<long int> (i)].rep.elts();
+
+	  for(size_t j = i + 1; j < m_k; j++)
+	    if((u[j / NTL_BITS_PER_LONG] >> (j % NTL_BITS_PER_LONG)) & 1)
+	      {
+		const _ntl_ulong *y = Uinv[static_cast<long int> (j)].
+		  rep.elts();
+
+		for(size_t w = j / NTL_BITS_PER_LONG; w < kw; w++)
+		  x[w] ^= y[w];
+	      }
+
+	  x[i / NTL_BITS_PER_LONG] ^= static_cast<_ntl_ulong> (1) <<
+	    (i % NTL_BITS_PER_LONG);
+	}
+
+      U.kill();
+
+      /*
+      ** Column j of U^-1 * L^-1 * Pi^T is column pi(j) of U^-1 *
+      ** L^-1.
+      */
+
+      m_Sinv.SetDims(k, k);
+
+      for(size_t i0 = 0; i0 < m_k; i0 += block)
+	{
+	  size_t rows = std::min(block, m_k - i0);
+
+	  mulRows(Y, Uinv, i0, rows, Linv);
+
+	  for(size_t i = 0; i < rows; i++)
+	    gatherBits(m_Sinv[static_cast<long int> (i0 + i)].rep.elts(),
+		       Y[static_cast<long int> (i)].rep.elts(),
+		       &pi.forward()[0],
+		       m_k);
+	}
+    }
+  catch(...)
+    {
+      NTL::clear(m_S);
+      NTL::clear(m_Sinv);
+      return false;
+    }
+
+  return true;
+}
+
+bool mcnoodle_private_key::prepareSqrtZ(void)
+{
+  try
+    {
+      /*
+      ** sqrt(z) = z^(2^(mt - 1)) mod g(z). Computed once per key,
+      ** every decryption then takes a square root with a single
+      ** multiplication.
+      */
+
+      std::vector<uint16_t> x;
+      std::vector<uint16_t> z(2, 0);
+
+      if(!m_context || mcnoodle_gf2m::polyDeg(m_gZ16) < 2)
+	throw std::exception();
+
+      z[1] = 1;
+      m_sqrtZ = z;
+      field().polyRem(m_sqrtZ, m_gZ16);
+
+      for(size_t i = 1; i < m_m * m_t; i++)
+	{
+	  field().polySqrMod(x, m_sqrtZ, m_gZ16);
+	  m_sqrtZ.swap(x);
+	}
+
+      field().polySqrMod(x, m_sqrtZ, m_gZ16);
+      field().polyRem(z, m_gZ16);
+
+      if(x != z)
+	throw std::exception();
+    }
+  catch(...)
+    {
+      m_ok = false;
+      m_sqrtZ.clear();
+      return false;
+    }
+
+  m_ok &= true;
+  return true;
+}
+
+bool mcnoodle_private_key::prepare_gZ(NTL::RandomStream &stream)
+{
+  try
+    {
+      if(!m_context)
+	throw std::exception();
+
+      /*
+      ** g(z) is drawn from stream over the field's tables.
+      */
+
+      if(!m_context->field().polyRandomIrreducible(m_gZ16,
+						   m_t,
+						   stream,
+						   m_gZAttempts))
+	throw std::exception();
+    }
+  catch(...)
+    {
+      m_gZ16.clear();
+      m_ok = false;
+      return false;
+    }
+
+  m_ok &= true;
+  return true;
+}
+
+void mcnoodle_private_key::releaseGcarFactors(void)
+{
+  /*
+  ** R and S serve Gcar alone. Sinv stays for decryption.
+  */
+
+  m_R.kill();
+  m_S.kill();
+}
+
+bool mcnoodle_private_key::prepareSwappingColumns
+(const NTL::vec_long &pivots)
+{
+  /*
+  ** pivots[i] is the identity column of row i of H, as recorded by
+  ** GaussJordan(). Positions i and pivots[i] are swapped in turn,
+  ** which brings the identity columns to the front in one pass.
+  */
+
+  long int n = static_cast<long int> (m_n);
+  long int r = n - static_cast<long int> (m_k);
+
+  if(pivots.length() != r)
+    {
+      m_ok = false;
+      return false;
+    }
+
+  m_swappingColumns.resize(static_cast<size_t> (n));
+
+  for(long int i = 0; i < n; i++)
+    m_swappingColumns[static_cast<size_t> (i)] = i;
+
+  for(long int i = 0; i < r; i++)
+    {
+      if(pivots[i] < i || pivots[i] >= n)
+	{
+	  m_swappingColumns.clear();
+	  m_ok = false;
+	  return false;
+	}
+
+      std::swap(m_swappingColumns[static_cast<size_t> (i)],
+		m_swappingColumns[static_cast<size_t> (pivots[i])]);
+    }
+
+  m_ok &= true;
+  return true;
+}
+
+mcnoodle_public_key::mcnoodle_public_key(const size_t m,
+					 const size_t t)
+{
+  m_ok = true;
+  m_systematic = false;
+  m_t = mcnoodle::minimumT(t);
+
+  /*
+  ** Gcar is sized by prepareGcar(), so that it is not held while
+  ** the code is found.
+  */
+
+  (void) m;
+}
+
+mcnoodle_public_key::~mcnoodle_public_key()
+{
+}
+
+bool mcnoodle_public_key::prepareGcar
+(const NTL::mat_GF2 &R,
+ const std::vector<long int> &swappingColumns,
+ const mcnoodle_permutation &P,
+ const NTL::mat_GF2 &S,
+ const size_t blockRows)
+{
+  /*
+  ** Gcar = S * G * P. Column swappingColumns[s] of G is column s of
+  ** [R | I], so row i of S * G, in that order, is row i of S * R
+  ** followed by row i of S. Neither G nor S * G is formed. Each
+  ** block of blockRows rows of S * R is gathered straight into its
+  ** rows of Gcar.
+  */
+
+  try
+    {
+      long int k = S.NumRows();
+      long int n = static_cast<long int> (swappingColumns.size());
+      long int r = n - k;
+
+      if(k <= 0 || r <= 0 || R.NumRows() != k || R.NumCols() != r ||
+	 S.NumCols() != k || static_cast<long int> (P.size()) != n)
+	throw std::exception();
+
+      size_t block = std::max(static_cast<size_t> (1),
+			      std::min(blockRows, static_cast<size_t> (k)));
+      size_t nw = static_cast<size_t>
+	((n + NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG);
+      NTL::mat_GF2 C;
+      std::vector<_ntl_ulong> y(nw);
+      std::vector<uint32_t> index(static_cast<size_t> (n));
+      std::vector<uint32_t> where(static_cast<size_t> (n));
+
+      for(size_t s = 0; s < where.size(); s++)
+	where[static_cast<size_t> (swappingColumns[s])] =
+	  static_cast<uint32_t> (s);
+
+      for(size_t q = 0; q < index.size(); q++)
+	index[q] = where[P.inverse()[q]];
+
+      m_Gcar.SetDims(k, n);
+
+      for(size_t i0 = 0; i0 < static_cast<size_t> (k); i0 += block)
+	{
+	  size_t rows = std::min(block, static_cast<size_t> (k) - i0);
+
+	  mulRows(C, S, i0, rows, R);
+
+	  for(size_t i = 0; i < rows; i++)
+	    {
+	      concatenateBits(&y[0],
+			      C[static_cast<long int> (i)].rep.elts(),
+			      static_cast<size_t> (r),
+			      S[static_cast<long int> (i0 + i)].rep.elts(),
+			      static_cast<size_t> (k));
+	      gatherBits(m_Gcar[static_cast<long int> (i0 + i)].rep.elts(),
+			 &y[0],
+			 &index[0],
+			 static_cast<size_t> (n));
+	    }
+	}
+    }
+  catch(...)
+    {
+      NTL::clear(m_Gcar);
+      m_ok = false;
+      return false;
+    }
+
+  m_ok &= true;
+  return true;
+}
+
+bool mcnoodle_public_key::prepareSystematic(void)
+{
+  /*
+  ** Gauss-Jordan on the words of Gcar, taking pivots from left to
+  ** right. The pivot columns become the information positions. Rows
+  ** below the current pivot are clear to its left, so eliminations
+  ** begin at the pivot's word.
+  */
+
+  try
+    {
+      long int k = m_Gcar.NumRows();
+      long int n = m_Gcar.NumCols();
+      long int r = 0;
+      std::vector<uint32_t> forward;
+      std::vector<uint32_t> redundancy;
+
+      if(k <= 0 || n <= k)
+	throw std::exception();
+
+      forward.reserve(static_cast<size_t> (n));
+      redundancy.reserve(static_cast<size_t> (n - k));
+
+      for(long int j = 0; j < n; j++)
+	{
+	  long int p = r;
+	  long int w = j / NTL_BITS_PER_LONG;
+	  _ntl_ulong bit = static_cast<_ntl_ulong> (1) <<
+	    (j % NTL_BITS_PER_LONG);
+
+	  while(p < k && !(m_Gcar[p].rep.elts()[w] & bit))
+	    p += 1;
+
+	  if(p == k)
+	    {
+	      redundancy.push_back(static_cast<uint32_t> (j));
+	      continue;
+	    }
+
+	  NTL::swap(m_Gcar[p], m_Gcar[r]);
+
+	  const _ntl_ulong *y = m_Gcar[r].rep.elts();
+	  long int words = m_Gcar[r].rep.length();
+
+	  for(long int i = 0; i < k; i++)
+	    if(i != r && (m_Gcar[i].rep.elts()[w] & bit))
+	      {
+		_ntl_ulong *x = m_Gcar[i].rep.elts();
+
+		for(long int l = w; l < words; l++)
+		  x[l] ^= y[l];
+	      }
+
+	  forward.push_back(static_cast<uint32_t> (j));
+	  r += 1;
+	}
+
+      if(r != k) // Gcar does not have full rank.
+	throw std::exception();
+
+      forward.insert(forward.end(), redundancy.begin(), redundancy.end());
+
+      if(!m_Q.prepare(forward))
+	throw std::exception();
+
+      m_R.SetDims(k, n - k);
+
+      for(long int i = 0; i < k; i++)
+	gatherBits(m_R[i].rep.elts(),
+		   m_Gcar[i].rep.elts(),
+		   &redundancy[0],
+		   redundancy.size());
+
+      m_Gcar.kill();
+      m_systematic = true;
+    }
+  catch(...)
+    {
+      NTL::clear(m_Gcar);
+      m_R.kill();
+      m_ok = false;
+      return false;
+    }
+
+  m_ok &= true;
+  return true;
+}
+
+mcnoodle::mcnoodle(const size_t m,
+		   const size_t t)
+{
+  m_keygenThreads = 0;
+  m_memoryBudget = 0;
+  m_privateKey = 0;
+  m_publicKey = 0;
+  m_systematic = false;
+
+  try
+    {
+      initializeSystemParameters(m, t);
+    }
+  catch(...)
+    {
+    }
+}
+
+mcnoodle::mcnoodle(const size_t m,
+		   const size_t t,
+		   const bool systematic)
+{
+  m_keygenThreads = 0;
+  m_memoryBudget = 0;
+  m_privateKey = 0;
+  m_publicKey = 0;
+  m_systematic = systematic;
+
+  try
+    {
+      initializeSystemParameters(m, t);
+    }
+  catch(...)
+    {
+    }
+}
+
+mcnoodle::~mcnoodle()
+{
+  delete m_privateKey;
+  delete m_publicKey;
+}
+
+bool mcnoodle::decrypt(const std::stringstream &ciphertext,
+		       std::stringstream &plaintext) const
+{
+  mcnoodle_decrypt_workspace workspace;
+
+  return decrypt(ciphertext, plaintext, workspace);
+}
+
+bool mcnoodle::decrypt(const char *ciphertext,
+		       const size_t ciphertext_size,
+		       char *plaintext,
+		       size_t &plaintext_size) const
+{
+  mcnoodle_decrypt_workspace workspace;
+
+  return decrypt
+    (ciphertext, ciphertext_size, plaintext, plaintext_size, workspace);
+}
+
+bool mcnoodle::decrypt(const char *ciphertext,
+		       const size_t ciphertext_size,
+		       char *plaintext,
+		       size_t &plaintext_size,
+		       mcnoodle_decrypt_workspace &workspace) const
+{
+  /*
+  ** On entry, plaintext_size is the capacity of plaintext. On
+  ** success, it is the length of the decrypted message.
+  */
+
+  if(!ciphertext || ciphertext_size != ciphertextSize() || !plaintext)
+    return false;
+
+  try
+    {
+      if(!readCiphertext(workspace.m_c, ciphertext, m_n))
+	return false;
+
+      if(!decryptVector(workspace))
+	return false;
+
+      return readMessage(plaintext, plaintext_size, workspace, m_k);
+    }
+  catch(...)
+    {
+      return false;
+    }
+}
+
+bool mcnoodle::decrypt(const std::stringstream &ciphertext,
+		       std::stringstream &plaintext,
+		       mcnoodle_decrypt_workspace &workspace) const
+{
+  size_t plaintext_size = static_cast<size_t>
+    (std::ceil(m_k / CHAR_BIT)); /*
+				 ** m_k is not necessarily
+				 ** a multiple of CHAR_BIT.
+				 ** It may be, however.
+				 */
+
+  if(plaintext_size <= 0) // Unlikely.
+    return false;
+
+  try
+    {
+      if(!readVector(ciphertext.rdbuf(),
+		     workspace.m_c,
+		     static_cast<long int> (m_n)))
+	return false;
+
+      if(!decryptVector(workspace))
+	return false;
+
+      std::vector<char> &p(workspace.m_plaintext);
+
+      p.resize(plaintext_size);
+      unpackBytes(reinterpret_cast<unsigned char *> (&p[0]),
+		  workspace.m_m.rep.elts(),
+		  plaintext_size);
+
+      /*
+      ** The text format carries no length. The plaintext ends at
+      ** its first NUL.
+      */
+
+      size_t size = 0;
+
+      while(size < plaintext_size && p[size] != 0)
+	size += 1;
+
+      plaintext.write(&p[0], static_cast<std::streamsize> (size));
+    }
+  catch(...)
+    {
+      plaintext.clear();
+      return false;
+    }
+
+  return true;
+}
+
+bool mcnoodle::decryptBatch(const char *ciphertexts,
+			    const size_t count,
+			    char *plaintexts,
+			    size_t *plaintext_sizes,
+			    bool *results,
+			    const size_t threads) const
+{
+  /*
+  ** Ciphertext i begins at i * ciphertextSize() and its plaintext
+  ** at i * maximumPlaintextSize(). Every worker owns a workspace.
+  ** The private key and its GF(2^m) tables are read-only, so the
+  ** workers share them.
+  */
+
+  if(!m_privateKey || !m_privateKey->ok())
+    return false;
+
+  if(count == 0)
+    return true;
+  else if(!ciphertexts || !plaintexts || !plaintext_sizes)
+    return false;
+
+  std::atomic<size_t> failures(0);
+  std::atomic<size_t> next(0);
+  size_t c_size = ciphertextSize();
+  size_t p_size = maximumPlaintextSize();
+
+  auto work = [&](void)
+    {
+      mcnoodle_decrypt_workspace workspace;
+
+      for(;;)
+	{
+	  size_t i = next.fetch_add(s_batchSize);
+
+	  if(i >= count)
+	    break;
+
+	  for(size_t j = i; j < std::min(count, i + s_batchSize); j++)
+	    {
+	      bool ok = false;
+
+	      plaintext_sizes[j] = p_size;
+	      ok = decrypt(ciphertexts + j * c_size,
+			   c_size,
+			   plaintexts + j * p_size,
+			   plaintext_sizes[j],
+			   workspace);
+
+	      if(!ok)
+		{
+		  failures.fetch_add(1);
+		  plaintext_sizes[j] = 0;
+		}
+
+	      if(results)
+		results[j] = ok;
+	    }
+	}
+    };
+
+  try
+    {
+      runWorkers(threads, count, work);
+    }
+  catch(...)
+    {
+      failures.fetch_add(1);
+    }
+
+  return failures.load() == 0 && next.load() >= count;
+}
+
+bool mcnoodle::decryptVector(mcnoodle_decrypt_workspace &workspace) const
+{
+  /*
+  ** Decodes workspace.m_c into the message workspace.m_m.
+  */
+
+  if(!m_privateKey || !m_privateKey->ok())
+    return false;
+
+  const NTL::vec_GF2 &c(workspace.m_c);
+
+  if(c.length() != static_cast<long int> (m_n))
+    return false;
+
+  NTL::vec_GF2 &ccar(workspace.m_ccar);
+
+  m_privateKey->P().applyInverse(ccar, c);
+
+  if(ccar.length() != static_cast<long int> (m_n) ||
+     !m_privateKey->preSynTab())
+    return false;
+
+  long int n = static_cast<long int> (m_n);
+
+  if(!workspace.correct(m_privateKey->field(),
+			m_privateKey->gZ16(),
+			m_privateKey->sqrtZ(),
+			m_privateKey->L(),
+			m_privateKey->preSynTab(),
+			m_privateKey->preSynTabStride(),
+			m_n,
+			m_t))
+    return false;
+
+  NTL::vec_GF2 &m(workspace.m_m);
+
+  if(!m_privateKey->messageColumns().empty())
+    {
+      /*
+      ** A systematic public key places the message in the clear.
+      */
+
+      m.SetLength(static_cast<long int> (m_k));
+      gatherBits(m.rep.elts(),
+		 ccar.rep.elts(),
+		 &m_privateKey->messageColumns()[0],
+		 m_k);
+      return true;
+    }
+
+  /*
+  ** mcar holds the last k columns of ccar in swapped order.
+  */
+
+  NTL::vec_GF2 &mcar(workspace.m_mcar);
+  const std::vector<long int> &swappingColumns
+    (m_privateKey->swappingColumns());
+  long int k = static_cast<long int> (m_k);
+
+  mcar.SetLength(k);
+  NTL::clear(mcar);
+
+  for(long int i = 0; i < k; i++)
+    if(ccar.get(swappingColumns[i + n - k]) != 0)
+      mcar.put(i, 1);
+
+  NTL::mul(m, mcar, m_privateKey->Sinv());
+  return true;
+}
+
+bool mcnoodle::encrypt(const char *plaintext,
+		       const size_t plaintext_size,
+		       char *ciphertext,
+		       const size_t ciphertext_size) const
+{
+  if(!m_publicKey || !m_publicKey->ok() || !plaintext || !ciphertext)
+    return false;
+
+  if(ciphertext_size != ciphertextSize() ||
+     plaintext_size > maximumPlaintextSize())
+    return false;
+
+  try
+    {
+      NTL::vec_GF2 c;
+      NTL::vec_GF2 m;
+
+      m.SetLength(static_cast<long int> (m_k));
+      packMessage(m.rep.elts(), plaintext, plaintext_size);
+
+      if(!encryptVector(c, m))
+	return false;
+
+      writeCiphertext(ciphertext, c.rep.elts(), m_n);
+    }
+  catch(...)
+    {
+      return false;
+    }
+
+  return true;
+}
+
+bool mcnoodle::encrypt(const char *plaintext,
+		       const size_t plaintext_size,
+		       std::stringstream &ciphertext) const
+{
+  if(!m_publicKey || !m_publicKey->ok() || !plaintext || plaintext_size <= 0)
+    return false;
+
+  if(CHAR_BIT * plaintext_size > static_cast<size_t> (m_k))
+    return false;
+
+  try
+    {
+      /*
+      ** Represent the message as a binary vector of length k.
+      */
+
+      NTL::vec_GF2 c;
+      NTL::vec_GF2 m;
+
+      m.SetLength(static_cast<long int> (m_k));
+      packBytes(m.rep.elts(),
+		reinterpret_cast<const unsigned char *> (plaintext),
+		plaintext_size);
+
+      if(!encryptVector(c, m))
+	return false;
+
+      ciphertext << c;
+    }
+  catch(...)
+    {
+      ciphertext.clear();
+      return false;
+    }
+
+  return true;
+}
+
+bool mcnoodle::encryptBatch(const char *plaintexts,
+			    const size_t *plaintext_sizes,
+			    const size_t count,
+			    char *ciphertexts) const
+{
+  /*
+  ** Plaintext i begins at i * maximumPlaintextSize() and its
+  ** ciphertext at i * ciphertextSize(). The count messages are the
+  ** rows of one count x k matrix, which is multiplied by Gcar in a
+  ** single pass.
+  */
+
+  if(!m_publicKey || !m_publicKey->ok() || m_publicKey->systematic())
+    return false;
+
+  if(count == 0)
+    return true;
+  else if(!plaintexts || !plaintext_sizes || !ciphertexts)
+    return false;
+
+  for(size_t i = 0; i < count; i++)
+    if(plaintext_sizes[i] > maximumPlaintextSize())
+      return false;
+
+  try
+    {
+      size_t c_size = ciphertextSize();
+      size_t cw = (m_n + NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG;
+      size_t p_size = maximumPlaintextSize();
+      NTL::mat_GF2 C;
+      NTL::mat_GF2 M;
+
+      M.SetDims(static_cast<long int> (count), static_cast<long int> (m_k));
+
+      for(size_t i = 0; i < count; i++)
+	packMessage(M[static_cast<long int> (i)].rep.elts(),
+		    plaintexts + i * p_size,
+		    plaintext_sizes[i]);
+
+      NTL::vec_GF2 e;
+      std::vector<_ntl_ulong> c(cw);
+
+      NTL::mul(C, M, m_publicKey->Gcar());
+
+      for(size_t i = 0; i < count; i++)
+	{
+	  const _ntl_ulong *x = C[static_cast<long int> (i)].rep.elts();
+
+	  prepareErrorVector(e, m_n, m_t);
+
+	  for(size_t j = 0; j < cw; j++)
+	    c[j] = x[j];
+
+	  const _ntl_ulong *ep = e.rep.elts();
+
+	  for(size_t j = 0; j < cw; j++)
+	    c[j] ^= ep[j];
+
+	  writeCiphertext(ciphertexts + i * c_size, &c[0], m_n);
+	}
+    }
+  catch(...)
+    {
+      return false;
+    }
+
+  return true;
+}
+
+bool mcnoodle::encryptVector(NTL::vec_GF2 &c, const NTL::vec_GF2 &m) const
+{
+  /*
+  ** A systematic key would place m in the clear.
+  */
+
+  if(m_publicKey->systematic())
+    return false;
+
+  NTL::vec_GF2 e;
+
+  prepareErrorVector(e, m_n, m_t);
+  NTL::mul(c, m, m_publicKey->Gcar());
+  c += e;
+  return true;
+}
+
+bool mcnoodle::generatePrivatePublicKeys(void)
+{
+  unsigned char seed[s_seedSize];
+
+  {
+    std::lock_guard<std::mutex> lock(s_ntlMutex);
+
+    NTL::GetCurrentRandomStream().get(seed, sizeof(seed));
+  }
+
+  return generatePrivatePublicKeys(seed);
+}
+
+bool mcnoodle::generatePrivatePublicKeys(const unsigned char *seed)
+{
+  if(!seed)
+    return false;
+
+  if(m_memoryBudget > 0 && keygenMemory() > m_memoryBudget)
+    return false;
+
+  delete m_privateKey;
+  m_privateKey = 0;
+  delete m_publicKey;
+  m_publicKey = 0;
+  m_keygenTimes.clear();
+  m_seed.clear();
+  m_privateKey = new (std::nothrow) mcnoodle_private_key(m_m, m_t);
+
+  if(!m_privateKey)
+    return false;
+
+  m_publicKey = new (std::nothrow) mcnoodle_public_key(m_m, m_t);
+
+  if(!m_publicKey)
+    {
+      delete m_privateKey;
+      m_privateKey = 0;
+      return false;
+    }
+
+  /*
+  ** The stages form a graph:
+  **
+  **   P ---------------------------------+
+  **   S, Sinv ---------------------------+-> Gcar
+  **   g(z), L -+-> H -> R ---------------+
+  **            +-> syndrome table
+  **
+  ** P and S are independent of the code and of each other. The seed
+  ** keys a stream that yields three sub-seeds, one each for P, S and
+  ** the code. Every stage is handed its own NTL::RandomStream made
+  ** from its sub-seed, so no stage draws from NTL's global stream.
+  ** The code chain, the critical path, stays on this thread with
+  ** the third stream.
+  **
+  ** G, with G = [R | I] up to its columns, and S * G are never
+  ** formed. The products are taken blockRows rows at a time and H,
+  ** R and S are released as soon as they are consumed. See
+  ** keygenMemory().
+  */
+
+  mcnoodle_stage stageP;
+  mcnoodle_stage stageS;
+  mcnoodle_stage stageSynTab;
+  size_t blockRows = keygenBlockRows();
+  std::chrono::steady_clock::time_point start
+    (std::chrono::steady_clock::now());
+
+  try
+    {
+      if(!m_privateKey->ok() || !m_publicKey->ok())
+	throw std::exception();
+
+      NTL::RandomStream stream(seed);
+      unsigned char seeds[3][s_seedSize];
+
+      for(size_t i = 0; i < 3; i++)
+	stream.get(seeds[i], static_cast<long int> (sizeof(seeds[i])));
+
+      m_seed.assign(seed, seed + s_seedSize);
+      stageP.start([this, seeds](void)
+		   {
+		     NTL::RandomStream stream(seeds[0]);
+
+		     return m_privateKey->prepareP(stream);
+		   });
+
+      stageS.start([this, seeds, blockRows](void)
+		   {
+		     NTL::RandomStream stream(seeds[1]);
+
+		     return m_privateKey->prepareS(stream, blockRows);
+		   });
+
+      /*
+      ** H is brought to reduced row echelon form by GaussJordan(),
+      ** which records the pivot column of each row as it finds it.
+      ** With rank mt the pivot columns hold an identity and H is
+      ** systematic up to a permutation of its columns. A lower rank,
+      ** which is rare, shows there. g(z) is then drawn again from the
+      ** code's stream, at the cost of one more code and not of a
+      ** keygen.
+      */
+
+      NTL::RandomStream codeStream(seeds[2]);
+      NTL::mat_GF2 H;
+      NTL::vec_long pivots;
+      const mcnoodle_gf2m &field(m_privateKey->field());
+      const std::vector<uint16_t> &L(m_privateKey->L());
+      long int m = static_cast<long int> (m_m);
+      long int n = static_cast<long int> (m_n);
+      long int rank = 0;
+      long int t = static_cast<long int> (m_t);
+      size_t codes = 0;
+      std::chrono::steady_clock::time_point t0;
+      std::vector<_ntl_ulong> words(static_cast<size_t> (m * t));
+      std::vector<uint16_t> y;
+
+      do
+	{
+	  if(codes++ == s_codeAttempts)
+	    throw std::exception();
+
+	  t0 = std::chrono::steady_clock::now();
+
+	  if(!m_privateKey->prepareGoppaCode(codeStream))
+	    throw std::exception();
+
+	  m_keygenTimes["goppa attempts"] += static_cast<double>
+	    (m_privateKey->gZAttempts());
+	  m_keygenTimes["goppa code"] += secondsSince(t0);
+	  t0 = std::chrono::steady_clock::now();
+
+	  /*
+	  ** Create the parity-check matrix H.
+	  */
+
+	  H.SetDims(m * t, n);
+
+	  /*
+	  ** Column j of H holds g(L[j])^-1 * L[j]^i, i < t, as m-bit
+	  ** elements. g is evaluated over the support at once and each
+	  ** power is one table multiplication from the last. A block of
+	  ** NTL_BITS_PER_LONG columns is gathered into one word per row
+	  ** of H and written whole.
+	  */
+
+	  field.polyEvalSupport(y, m_privateKey->gZ16(), L);
+
+	  for(long int j0 = 0; j0 < n; j0 += NTL_BITS_PER_LONG)
+	    {
+	      long int j1 = std::min(n, j0 + NTL_BITS_PER_LONG);
+
+	      std::fill(words.begin(), words.end(), 0);
+
+	      for(long int j = j0; j < j1; j++)
+		{
+		  _ntl_ulong *w = &words[0];
+		  uint16_t v = field.inv(y[j]);
+
+		  for(long int i = 0; i < t; i++, w += m)
+		    {
+		      for(uint16_t e = v, k = 0; e != 0; e >>= 1, k++)
+			w[k] |= static_cast<_ntl_ulong> (e & 1) << (j - j0);
+
+		      v = field.mul(v, L[j]);
+		    }
+		}
+
+	      for(long int i = 0; i < m * t; i++)
+		H[i].rep.elts()[j0 / NTL_BITS_PER_LONG] = words[i];
+	    }
+
+	  rank = NTL::GaussJordan(H, pivots);
+	  m_keygenTimes["H, G"] += secondsSince(t0);
+	}
+      while(rank != m * t);
+
+      m_keygenTimes["code attempts"] = static_cast<double> (codes);
+      stageSynTab.start([this](void)
+			{
+			  return m_privateKey->preparePreSynTab
+			    (m_keygenThreads);
+			});
+      t0 = std::chrono::steady_clock::now();
+
+      if(!m_privateKey->prepareSwappingColumns(pivots) ||
+	 !m_privateKey->prepareG(H))
+	throw std::exception();
+
+      H.kill();
+
+      m_keygenTimes["H, G"] += secondsSince(t0);
+
+      bool ok = true;
+
+      ok &= stageP.join();
+      ok &= stageS.join();
+      ok &= stageSynTab.join();
+      m_keygenTimes["P"] = stageP.seconds();
+      m_keygenTimes["S"] = stageS.seconds();
+      m_keygenTimes["syndrome table"] = stageSynTab.seconds();
+
+      if(!ok)
+	throw std::exception();
+
+      t0 = std::chrono::steady_clock::now();
+
+      if(!m_publicKey->prepareGcar(m_privateKey->R(),
+				   m_privateKey->swappingColumns(),
+				   m_privateKey->P(),
+				   m_privateKey->S(),
+				   blockRows))
+	throw std::exception();
+
+      m_privateKey->releaseGcarFactors();
+
+      if(m_systematic)
+	if(!m_publicKey->prepareSystematic() ||
+	   !m_privateKey->prepareMessageColumns(m_publicKey->Q()))
+	  throw std::exception();
+
+      m_keygenTimes["Gcar"] = secondsSince(t0);
+      m_keygenTimes["total"] = secondsSince(start);
+    }
+  catch(...)
+    {
+      stageP.join();
+      stageS.join();
+      stageSynTab.join();
+      delete m_privateKey;
+      m_privateKey = 0;
+      delete m_publicKey;
+      m_publicKey = 0;
+      m_seed.clear();
+      return false;
+    }
+
+  return true;
+}
+
+size_t mcnoodle::keygenBlockRows(void) const
+{
+  /*
+  ** Without a budget, or with one that the row blocks cannot fit,
+  ** the blocks are s_blockRows rows or NTL_BITS_PER_LONG rows. Blocks
+  ** larger than s_blockRows gain nothing, as the products stream
+  ** their rows.
+  */
+
+  size_t maximum = std::min(m_k, s_blockRows);
+  size_t minimum = std::min(m_k, static_cast<size_t> (NTL_BITS_PER_LONG));
+
+  if(m_memoryBudget == 0)
+    return maximum;
+
+  size_t fixed = keygenMemory(0);
+  size_t row = keygenMemory(1) - fixed;
+
+  if(m_memoryBudget <= fixed || row == 0)
+    return minimum;
+
+  return std::max(minimum,
+		  std::min(maximum, (m_memoryBudget - fixed) / row));
+}
+
+size_t mcnoodle::keygenMemory(void) const
+{
+  return keygenMemory(keygenBlockRows());
+}
+
+size_t mcnoodle::keygenMemory(const size_t blockRows) const
+{
+  /*
+  ** The matrices of the three phases of keygen, rows of NTL vectors
+  ** counted with their heap headers. The first phase finds the code
+  ** while S and Sinv are formed from four k x k matrices at most,
+  ** the second forms Gcar from S and R, and the third reduces Gcar
+  ** to systematic form. Vectors of n or fewer entries are covered
+  ** by a margin of 64 bytes per position.
+  */
+
+  const size_t header = 64;
+  size_t k = m_k;
+  size_t n = m_n;
+  size_t r = m_n - m_k;
+  size_t kw = (k + NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG;
+  size_t nw = (n + NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG;
+  size_t rw = (r + NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG;
+  size_t stride = 8 * (((m_t + 3) / 4 + 7) / 8);
+  size_t synTab = sizeof(uint64_t) * (n * stride + 8);
+  size_t kk = k * (kw * sizeof(_ntl_ulong) + header);
+  size_t kr = k * (rw * sizeof(_ntl_ulong) + header);
+  size_t kn = k * (nw * sizeof(_ntl_ulong) + header);
+  size_t rk = r * (kw * sizeof(_ntl_ulong) + header);
+  size_t rn = r * (nw * sizeof(_ntl_ulong) + header);
+  size_t small = header * n;
+  size_t block = blockRows * (kw * sizeof(_ntl_ulong) + header);
+  size_t phase1 = 4 * kk + 2 * block + rn + rk + kr + synTab;
+  size_t phase2 = 2 * kk + kr + kn + synTab + block +
+    blockRows * (rw * sizeof(_ntl_ulong) + header) + nw * sizeof(_ntl_ulong);
+  size_t phase3 = kk + kn + kr + synTab;
+
+  return small + std::max(phase1, std::max(phase2, phase3));
+}
+
+void mcnoodle::packMessage(_ntl_ulong *x,
+			   const char *plaintext,
+			   const size_t plaintext_size)
+{
+  /*
+  ** The message is the plaintext's length followed by the
+  ** plaintext. The k bits of x must be clear.
+  */
+
+  unsigned char length[s_lengthSize];
+
+  for(size_t i = 0; i < s_lengthSize; i++)
+    length[i] = static_cast<unsigned char>
+      (plaintext_size >> (CHAR_BIT * (s_lengthSize - i - 1)));
+
+  packBytes(x, length, s_lengthSize);
+  packBytes(x,
+	    reinterpret_cast<const unsigned char *> (plaintext),
+	    plaintext_size,
+	    s_lengthSize);
+}
+
+bool mcnoodle::readCiphertext(NTL::vec_GF2 &c,
+			      const char *ciphertext,
+			      const size_t n)
+{
+  /*
+  ** The inverse of writeCiphertext(). The header must hold n.
+  */
+
+  const unsigned char *p = reinterpret_cast<const unsigned char *>
+    (ciphertext);
+  size_t size = 0;
+
+  for(size_t i = 0; i < s_headerSize; i++)
+    size = (size << CHAR_BIT) | p[i];
+
+  if(size != n)
+    return false;
+
+  c.SetLength(static_cast<long int> (n));
+  NTL::clear(c);
+  packBytes(c.rep.elts(), p + s_headerSize, n / CHAR_BIT);
+  return true;
+}
+
+bool mcnoodle::readMessage(char *plaintext,
+			   size_t &plaintext_size,
+			   mcnoodle_decrypt_workspace &workspace,
+			   const size_t k)
+{
+  /*
+  ** The inverse of packMessage(), from workspace.m_m. On entry,
+  ** plaintext_size is the capacity of plaintext.
+  */
+
+  std::vector<char> &p(workspace.m_plaintext);
+  size_t maximum = k / CHAR_BIT - s_lengthSize;
+  size_t size = s_lengthSize + maximum;
+
+  p.resize(size);
+  unpackBytes(reinterpret_cast<unsigned char *> (&p[0]),
+	      workspace.m_m.rep.elts(),
+	      size);
+  size = 0;
+
+  for(size_t i = 0; i < s_lengthSize; i++)
+    size = (size << CHAR_BIT) | static_cast<unsigned char> (p[i]);
+
+  if(size > maximum || size > plaintext_size)
+    return false;
+
+  memcpy(plaintext, &p[s_lengthSize], size);
+  plaintext_size = size;
+  return true;
+}
+
+void mcnoodle::prepareErrorVector(NTL::vec_GF2 &e,
+				  const size_t n,
+				  const size_t t)
+{
+  /*
+  ** Create the random vector e of length n. It will contain t ones.
+  */
+
+  long int ts = 0;
+
+  e.SetLength(static_cast<long int> (n));
+  NTL::clear(e);
+
+  std::lock_guard<std::mutex> lock(s_ntlMutex);
+
+  do
+    {
+      long int i = NTL::RandomBnd(e.length());
+
+      if(e[i] == 0)
+	{
+	  e[i] = 1;
+	  ts += 1;
+	}
+    }
+  while(static_cast<long int> (t) > ts);
+}
+
+void mcnoodle::setKeygenThreads(const size_t threads)
+{
+  m_keygenThreads = threads;
+}
+
+void mcnoodle::setMemoryBudget(const size_t bytes)
+{
+  m_memoryBudget = bytes;
+}
+
+void mcnoodle::writeCiphertext(char *ciphertext,
+			       const _ntl_ulong *c,
+			       const size_t n)
+{
+  unsigned char *p = reinterpret_cast<unsigned char *> (ciphertext);
+
+  for(size_t i = 0; i < s_headerSize; i++)
+    p[i] = static_cast<unsigned char>
+      (n >> (CHAR_BIT * (s_headerSize - i - 1)));
+
+  unpackBytes(p + s_headerSize, c, n / CHAR_BIT);
+}
+
+mcnoodle_key_pool::mcnoodle_key_pool(const size_t m,
+				     const size_t t,
+				     const size_t capacity,
+				     const size_t threads,
+				     const bool systematic)
+{
+  m_acquired = 0;
+  m_capacity = capacity;
+  m_failures = 0;
+  m_generated = 0;
+  m_keygenSeconds = 0.0;
+  m_keygenThreads = 1;
+  m_m = m;
+  m_pending = 0;
+  m_stalls = 0;
+  m_start = std::chrono::steady_clock::now();
+  m_stop = false;
+  m_systematic = systematic;
+  m_t = t;
+
+  size_t workers = threads;
+
+  if(workers == 0)
+    workers = std::max
+      (static_cast<size_t> (1),
+       static_cast<size_t> (std::thread::hardware_concurrency()));
+
+  /*
+  ** The workers share the cores among their keygens.
+  */
+
+  m_keygenThreads = std::max
+    (static_cast<size_t> (1),
+     static_cast<size_t> (std::thread::hardware_concurrency()) / workers);
+
+  for(size_t i = 0; i < workers; i++)
+    try
+      {
+	m_threads.push_back(std::thread(&mcnoodle_key_pool::refill, this));
+      }
+    catch(...)
+      {
+	break;
+      }
+}
+
+mcnoodle_key_pool::~mcnoodle_key_pool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_stop = true;
+  }
+
+  m_condition.notify_all();
+
+  for(size_t i = 0; i < m_threads.size(); i++)
+    m_threads[i].join();
+
+  for(size_t i = 0; i < m_keys.size(); i++)
+    delete m_keys[i];
+}
+
+mcnoodle *mcnoodle_key_pool::acquire(void)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if(m_keys.empty())
+    {
+      m_stalls += 1;
+      return 0;
+    }
+
+  mcnoodle *key = m_keys.front();
+
+  m_acquired += 1;
+  m_keys.pop_front();
+  m_condition.notify_one();
+  return key;
+}
+
+size_t mcnoodle_key_pool::depth(void) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  return m_keys.size();
+}
+
+std::map<std::string, double> mcnoodle_key_pool::statistics(void) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::map<std::string, double> statistics;
+  double seconds = secondsSince(m_start);
+
+  statistics["acquired"] = static_cast<double> (m_acquired);
+  statistics["capacity"] = static_cast<double> (m_capacity);
+  statistics["depth"] = static_cast<double> (m_keys.size());
+  statistics["failures"] = static_cast<double> (m_failures);
+  statistics["generated"] = static_cast<double> (m_generated);
+  statistics["keygen seconds"] = m_generated > 0 ?
+    m_keygenSeconds / static_cast<double> (m_generated) : 0.0;
+  statistics["refill rate"] = seconds > 0.0 ?
+    static_cast<double> (m_generated) / seconds : 0.0;
+  statistics["stalls"] = static_cast<double> (m_stalls);
+  statistics["threads"] = static_cast<double> (m_threads.size());
+  return statistics;
+}
+
+void mcnoodle_key_pool::refill(void)
+{
+  /*
+  ** Keygens in progress count against the capacity so that the
+  ** workers do not overfill the pool between them.
+  */
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  for(;;)
+    {
+      m_condition.wait(lock, [this](void)
+			     {
+			       return m_stop ||
+				 m_keys.size() + m_pending < m_capacity;
+			     });
+
+      if(m_stop)
+	break;
+
+      m_pending += 1;
+      lock.unlock();
+
+      std::chrono::steady_clock::time_point start
+	(std::chrono::steady_clock::now());
+      mcnoodle *key = new (std::nothrow) mcnoodle(m_m, m_t, m_systematic);
 
-  for(long int i = 0; i < n; i++)
-    m_swappingColumns.push_back(i);
-}
+      if(key)
+	key->setKeygenThreads(m_keygenThreads);
 
-void mcnoodle_private_key::swapSwappingColumns(const long int i,
-					       const long int j)
-{
-  if(static_cast<size_t> (i) >= m_swappingColumns.size() ||
-     static_cast<size_t> (j) >= m_swappingColumns.size())
-    {
-      m_ok = false;
-      return;
-    }
+      bool ok = key && key->generatePrivatePublicKeys();
+      double seconds = secondsSince(start);
 
-  long int t = m_swappingColumns[i];
+      lock.lock();
+      m_pending -= 1;
 
-  m_swappingColumns[i] = m_swappingColumns[j];
-  m_swappingColumns[j] = t;
+      if(ok)
+	{
+	  m_generated += 1;
+	  m_keygenSeconds += seconds;
+	  m_keys.push_back(key);
+	}
+      else
+	{
+	  delete key;
+	  m_failures += 1;
+	}
+    }
 }
 
-mcnoodle_public_key::mcnoodle_public_key(const size_t m,
-					 const size_t t)
+bool mcnoodle::privateKeyFile(std::vector<unsigned char> &file) const
 {
-  m_ok = true;
-  m_t = mcnoodle::minimumT(t);
+  if(!m_privateKey || !m_privateKey->ok() || !m_privateKey->preSynTab())
+    return false;
 
-  /*
-  ** Some calculations.
-  */
+  try
+    {
+      mcnoodle_key_file_header header;
+      std::vector<_ntl_ulong> Sinv;
+      std::vector<std::pair<const void *, size_t> > sections;
+      std::vector<uint32_t> columns(m_privateKey->messageColumns());
+
+      memset(&header, 0, sizeof(header));
+      header.flags = m_systematic ? s_keyFileSystematic : 0;
+      header.k = m_k;
+      header.m = m_m;
+      header.modulus = m_privateKey->field().modulus();
+      header.n = m_n;
+      header.t = m_t;
+      header.type = mcnoodle_key_file::s_privateKey;
+
+      if(!m_systematic)
+	{
+	  columns.resize(m_k);
 
-  long int k = 0;
-  long int n = 1 << static_cast<long int> (m);
+	  for(size_t i = 0; i < m_k; i++)
+	    columns[i] = static_cast<uint32_t>
+	      (m_privateKey->swappingColumns()[i + m_n - m_k]);
 
-  k = n - static_cast<long int> (m) * static_cast<long int> (m_t);
-  m_Gcar.SetDims(k, n);
-}
+	  flattenRows(Sinv, m_privateKey->Sinv());
+	}
 
-mcnoodle_public_key::~mcnoodle_public_key()
-{
+      sections.push_back
+	(std::make_pair(&m_privateKey->gZ16()[0],
+			2 * m_privateKey->gZ16().size()));
+      sections.push_back
+	(std::make_pair(&m_privateKey->sqrtZ()[0],
+			2 * m_privateKey->sqrtZ().size()));
+      sections.push_back
+	(std::make_pair(&m_privateKey->L()[0], 2 * m_privateKey->L().size()));
+      sections.push_back
+	(std::make_pair(&m_privateKey->P().forward()[0], 4 * m_n));
+      sections.push_back
+	(std::make_pair(m_privateKey->preSynTab(),
+			8 * m_n * m_privateKey->preSynTabStride()));
+      sections.push_back(std::make_pair(&columns[0], 4 * m_k));
+      sections.push_back
+	(std::make_pair(Sinv.empty() ? 0 : &Sinv[0],
+			sizeof(_ntl_ulong) * Sinv.size()));
+      return layoutKeyFile(file, header, sections);
+    }
+  catch(...)
+    {
+      return false;
+    }
 }
 
-bool mcnoodle_public_key::prepareGcar(const NTL::mat_GF2 &G,
-				      const NTL::mat_GF2 &P,
-				      const NTL::mat_GF2 &S)
+bool mcnoodle::writePrivateKey(const char *path) const
 {
   try
     {
-      m_Gcar = S * G * P;
+      std::vector<unsigned char> file;
+
+      return privateKeyFile(file) && writeFile(path, file, true);
     }
   catch(...)
     {
-      NTL::clear(m_Gcar);
-      m_ok = false;
       return false;
     }
-
-  m_ok &= true;
-  return true;
 }
 
-mcnoodle::mcnoodle(const size_t m,
-		   const size_t t)
+bool mcnoodle::writePublicKey(const char *path) const
 {
-  m_privateKey = 0;
-  m_publicKey = 0;
+  if(!m_publicKey || !m_publicKey->ok())
+    return false;
 
   try
     {
-      initializeSystemParameters(m, t);
+      mcnoodle_key_file_header header;
+      std::vector<_ntl_ulong> G;
+      std::vector<std::pair<const void *, size_t> > sections;
+
+      memset(&header, 0, sizeof(header));
+      header.flags = m_systematic ? s_keyFileSystematic : 0;
+      header.k = m_k;
+      header.m = m_m;
+      header.n = m_n;
+      header.t = m_t;
+      header.type = mcnoodle_key_file::s_publicKey;
+
+      if(m_systematic)
+	flattenRows(G, m_publicKey->R());
+      else
+	flattenRows(G, m_publicKey->Gcar());
+
+      sections.push_back
+	(std::make_pair(&G[0], sizeof(_ntl_ulong) * G.size()));
+
+      if(m_systematic)
+	sections.push_back
+	  (std::make_pair(&m_publicKey->Q().inverse()[0], 4 * m_n));
+
+      std::vector<unsigned char> file;
+
+      return layoutKeyFile(file, header, sections) &&
+	writeFile(path, file, false);
     }
   catch(...)
     {
+      return false;
     }
 }
 
-mcnoodle::~mcnoodle()
+mcnoodle_key_file::mcnoodle_key_file(void)
 {
-  delete m_privateKey;
-  delete m_publicKey;
+  m_data = 0;
+  m_k = 0;
+  m_m = 0;
+  m_modulus = 0;
+  m_n = 0;
+  m_size = 0;
+  m_systematic = false;
+  m_t = 0;
 }
 
-bool mcnoodle::decrypt(const std::stringstream &ciphertext,
-		       std::stringstream &plaintext) const
+mcnoodle_key_file::~mcnoodle_key_file()
 {
-  if(!m_privateKey || !m_privateKey->ok())
-    return false;
+  close();
+}
 
-  size_t plaintext_size = static_cast<size_t>
-    (std::ceil(m_k / CHAR_BIT)); /*
-				 ** m_k is not necessarily
-				 ** a multiple of CHAR_BIT.
-				 ** It may be, however.
-				 */
+bool mcnoodle_key_file::open(const char *path,
+			     const uint32_t type,
+			     const bool verify)
+{
+  close();
 
-  if(plaintext_size <= 0) // Unlikely.
+  if(!path)
     return false;
 
-  char *p = new (std::nothrow) char[plaintext_size];
+  int fd = ::open(path, O_RDONLY);
 
-  if(!p)
+  if(fd < 0)
     return false;
 
-  try
-    {
-      NTL::vec_GF2 c;
-      std::stringstream s;
-
-      s << ciphertext.rdbuf();
-      s >> c;
-
-      if(c.length() != static_cast<long int> (m_n))
-	{
-	  delete []p;
-	  return false;
-	}
-
-      NTL::vec_GF2 ccar = c * m_privateKey->Pinv();
-
-      if(ccar.length() != static_cast<long int> (m_n) ||
-	 m_n != m_privateKey->preSynTab().size())
-	{
-	  delete []p;
-	  return false;
-	}
-
-      /*
-      ** Patterson.
-      */
-
-      NTL::GF2EX syndrome = NTL::GF2EX::zero();
-      long int n = static_cast<long int> (m_n);
-      std::vector<NTL::GF2EX> v(m_privateKey->preSynTab());
+  struct stat st;
 
-      for(long int i = 0; i < n; i++)
-	if(ccar[i] != 0)
-	  syndrome += v[i];
+  if(fstat(fd, &st) != 0 ||
+     st.st_size < static_cast<off_t> (sizeof(mcnoodle_key_file_header)))
+    {
+      ::close(fd);
+      return false;
+    }
 
-      NTL::GF2EX sigma = NTL::GF2EX::zero();
+  void *data = mmap
+    (0, static_cast<size_t> (st.st_size), PROT_READ, MAP_SHARED, fd, 0);
 
-      if(!NTL::IsZero(syndrome))
-	{
-	  NTL::GF2EX T = NTL::InvMod(syndrome, m_privateKey->gZ()) +
-	    m_privateKey->X();
-	  NTL::GF2EX alpha = NTL::GF2EX::zero();
-	  NTL::GF2EX beta = NTL::GF2EX::zero();
-	  NTL::GF2EX gamma = NTL::GF2EX::zero();
-	  NTL::GF2EX tau = NTL::GF2EX::zero();
-	  NTL::ZZ exponent = NTL::power
-	    (NTL::power2_ZZ(static_cast<long int> (m_t)),
-	     static_cast<long int> (m_m)) / 2;
-
-	  if(NTL::IsZero(T))
-	    sigma = m_privateKey->X();
-	  else
-	    {
-	      tau = NTL::PowerMod(T, exponent, m_privateKey->gZ());
-
-	      NTL::GF2E c1;
-	      NTL::GF2E c2;
-	      NTL::GF2E c3;
-	      NTL::GF2E c4;
-	      NTL::GF2EX gf2ex = NTL::GF2EX::zero();
-	      NTL::GF2EX r0 = m_privateKey->gZ();
-	      NTL::GF2EX r1 = tau;
-	      NTL::GF2EX u0 = NTL::GF2EX::zero();
-	      NTL::GF2EX u1;
-	      long int dr = NTL::deg(r1);
-	      long int dt = NTL::deg(r0) - dr;
-	      long int du = 0;
-	      long int t = static_cast<long int> (m_t / 2);
-
-	      u1.SetLength(1);
-	      NTL::SetCoeff(u1, 0, 1);
-
-	      while(dr >= t + 1)
-		{
-		  for(long int j = dt; j >= 0; j--)
-		    {
-		      NTL::GetCoeff(c1, r0, dr + j);
-		      NTL::GetCoeff(c2, r1, dr);
-		      c3 = c1 * NTL::inv(c2);
-		      c1 = c3;
+  ::close(fd);
 
-		      if(!NTL::IsZero(c1))
-			{
-			  for(long int i = 0; i <= du; i++)
-			    {
-			      NTL::GetCoeff(c3, u0, i + j);
-			      NTL::GetCoeff(c4, u1, i);
-			      c3 = c3 + c1 * c4;
-			      NTL::SetCoeff(u0, i + j, c3);
-			    }
-
-			  for(long int i = 0; i <= dr; i++)
-			    {
-			      NTL::GetCoeff(c3, r0, i + j);
-			      NTL::GetCoeff(c4, r1, i);
-			      c3 = c3 + c1 * c4;
-			      NTL::SetCoeff(r0, i + j, c3);
-			    }
-			}
-		    }
+  if(data == MAP_FAILED)
+    return false;
 
-		  gf2ex = r0;
-		  r0 = r1;
-		  r1 = gf2ex;
-		  gf2ex = u0;
-		  u0 = u1;
-		  u1 = gf2ex;
-		  du = du + dt;
-		  dt = 1;
-		  NTL::GetCoeff(c3, r1, dr - dt);
-
-		  while(NTL::IsZero(c3))
-		    {
-		      dt++;
-		      NTL::GetCoeff(c3, r1, dr - dt);
-		    }
+  m_data = static_cast<const unsigned char *> (data);
+  m_size = static_cast<size_t> (st.st_size);
+  return check(type, verify);
+}
 
-		  dr -= dt;
-		}
+bool mcnoodle_key_file::open(const std::vector<unsigned char> &image,
+			     const uint32_t type)
+{
+  close();
 
-	      gamma = u1;
-	      beta = r1;
-	      NTL::rem(alpha, beta, m_privateKey->gZ());
-	      sigma = NTL::power(alpha, 2) +
-		NTL::power(gamma, 2) * m_privateKey->X();
-	    }
-	}
+  if(image.size() < sizeof(mcnoodle_key_file_header))
+    return false;
 
-      NTL::vec_GF2 e;
-      NTL::vec_GF2E L = m_privateKey->L();
+  try
+    {
+      m_image.resize(image.size() + s_keyFileAlignment - 1);
+    }
+  catch(...)
+    {
+      m_image.clear();
+      return false;
+    }
 
-      e.SetLength(n);
+  size_t offset = (s_keyFileAlignment -
+		   reinterpret_cast<uintptr_t> (&m_image[0]) %
+		   s_keyFileAlignment) % s_keyFileAlignment;
 
-      for(long int i = 0; i < n; i++)
-	if(NTL::IsZero(NTL::eval(sigma, L[i])))
-	  e[i] = 1;
+  memcpy(&m_image[offset], &image[0], image.size());
+  m_data = &m_image[offset];
+  m_size = image.size();
+  return check(type, false);
+}
 
-      ccar += e;
+bool mcnoodle_key_file::check(const uint32_t type, const bool verify)
+{
+  const mcnoodle_key_file_header *header =
+    reinterpret_cast<const mcnoodle_key_file_header *> (m_data);
+  bool ok = true;
+
+  ok &= memcmp(header->magic, s_keyFileMagic, sizeof(header->magic)) == 0;
+  ok &= header->byteOrder == s_keyFileByteOrder;
+  ok &= header->headerChecksum ==
+    checksum(m_data, offsetof(mcnoodle_key_file_header, headerChecksum));
+  ok &= header->size == m_size;
+  ok &= header->type == type;
+  ok &= header->version == s_version;
+  ok &= header->wordBits == NTL_BITS_PER_LONG;
+  ok &= header->m >= 2 && header->m <= 16;
+  ok &= ok && header->n == static_cast<uint64_t> (1) << header->m;
+  ok &= ok && header->k + header->m * header->t == header->n;
+
+  size_t start = s_keyFileAlignment *
+    ((sizeof(*header) + s_keyFileAlignment - 1) / s_keyFileAlignment);
+
+  ok &= start <= m_size;
+
+  for(size_t i = 0; ok && i < 8; i++)
+    ok &= header->sections[i][0] % s_keyFileAlignment == 0 &&
+      header->sections[i][0] <= m_size &&
+      header->sections[i][1] <= m_size - header->sections[i][0] &&
+      (header->sections[i][1] == 0 || header->sections[i][0] >= start);
+
+  if(ok && verify)
+    ok &= header->payloadChecksum == checksum(m_data + start, m_size - start);
+
+  if(!ok)
+    {
+      close();
+      return false;
+    }
 
-      NTL::vec_GF2 m;
-      NTL::vec_GF2 mcar;
-      NTL::vec_GF2 vec_GF2;
-      std::vector<long int> swappingColumns(m_privateKey->swappingColumns());
+  m_k = static_cast<size_t> (header->k);
+  m_m = static_cast<size_t> (header->m);
+  m_modulus = static_cast<uint32_t> (header->modulus);
+  m_n = static_cast<size_t> (header->n);
+  m_systematic = header->flags & s_keyFileSystematic;
+  m_t = static_cast<size_t> (header->t);
+  return true;
+}
 
-      vec_GF2.SetLength(n);
+const void *mcnoodle_key_file::section(const size_t i, const size_t size) const
+{
+  if(!m_data || i >= 8 || size == 0 || sectionSize(i) != size)
+    return 0;
 
-      for(long int i = 0; i < n; i++)
-	vec_GF2[i] = ccar[swappingColumns[i]];
+  const mcnoodle_key_file_header *header =
+    reinterpret_cast<const mcnoodle_key_file_header *> (m_data);
 
-      long int k = static_cast<long int> (m_k);
+  return m_data + header->sections[i][0];
+}
 
-      mcar.SetLength(k);
+size_t mcnoodle_key_file::sectionSize(const size_t i) const
+{
+  if(!m_data || i >= 8)
+    return 0;
 
-      for(long int i = 0; i < k; i++)
-	mcar[i] = vec_GF2[i + n - k];
+  const mcnoodle_key_file_header *header =
+    reinterpret_cast<const mcnoodle_key_file_header *> (m_data);
 
-      m = mcar * m_privateKey->Sinv();
-      memset(p, 0, plaintext_size);
+  return static_cast<size_t> (header->sections[i][1]);
+}
 
-      for(long int i = 0, k = 0; i < static_cast<long int> (plaintext_size);
-	  i++)
-	{
-	  std::bitset<CHAR_BIT> b;
+void mcnoodle_key_file::close(void)
+{
+  if(m_data && m_image.empty())
+    munmap(const_cast<unsigned char *> (m_data), m_size);
 
-	  for(long int j = 0; j < CHAR_BIT && k < m.length(); j++, k++)
-	    b[static_cast<size_t> (j)] = m[k] == 0 ? 0 : 1;
+  std::vector<unsigned char> ().swap(m_image);
 
-	  p[i] = static_cast<char> (b.to_ulong());
-	}
+  m_data = 0;
+  m_k = 0;
+  m_m = 0;
+  m_modulus = 0;
+  m_n = 0;
+  m_size = 0;
+  m_systematic = false;
+  m_t = 0;
+}
 
-      plaintext << p;
-    }
-  catch(...)
+mcnoodle_encrypt_key::mcnoodle_encrypt_key(const char *path,
+					   const bool verify)
+{
+  m_G = 0;
+  m_Qinverse = 0;
+  m_k = 0;
+  m_n = 0;
+  m_ok = false;
+  m_t = 0;
+  m_words = 0;
+
+  if(!m_file.open(path, mcnoodle_key_file::s_publicKey, verify))
+    return;
+
+  m_k = m_file.k();
+  m_n = m_file.n();
+  m_t = m_file.t();
+  m_words = ((m_file.systematic() ? m_n - m_k : m_n) +
+	     NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG;
+  m_G = static_cast<const _ntl_ulong *>
+    (m_file.section(0, sizeof(_ntl_ulong) * m_k * m_words));
+
+  if(m_file.systematic())
     {
-      delete []p;
-      plaintext.clear();
-      return false;
+      m_Qinverse = static_cast<const uint32_t *>
+	(m_file.section(1, 4 * m_n));
+
+      if(!m_Qinverse || !isPermutation(m_Qinverse, m_n))
+	return;
     }
 
-  delete []p;
-  return true;
+  m_ok = m_G != 0;
 }
 
-bool mcnoodle::encrypt(const char *plaintext,
-		       const size_t plaintext_size,
-		       std::stringstream &ciphertext) const
+mcnoodle_encrypt_key::~mcnoodle_encrypt_key()
 {
-  if(!m_publicKey || !m_publicKey->ok() || !plaintext || plaintext_size <= 0)
+}
+
+bool mcnoodle_encrypt_key::encrypt(const char *plaintext,
+				   const size_t plaintext_size,
+				   char *ciphertext,
+				   const size_t ciphertext_size) const
+{
+  /*
+  ** A systematic key would place the plaintext in the clear.
+  */
+
+  if(!m_ok || m_Qinverse || !plaintext || !ciphertext)
     return false;
 
-  if(CHAR_BIT * plaintext_size > static_cast<size_t> (m_k))
+  if(ciphertext_size != ciphertextSize() ||
+     plaintext_size > maximumPlaintextSize())
     return false;
 
   try
     {
-      /*
-      ** Represent the message as a binary vector of length k.
-      */
-
-      NTL::vec_GF2 m;
-
-      m.SetLength(static_cast<long int> (m_k));
-
-      for(size_t i = 0, k = 0; i < plaintext_size; i++)
-	{
-	  std::bitset<CHAR_BIT> b(plaintext[i]);
+      NTL::vec_GF2 e;
+      size_t kw = (m_k + NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG;
+      size_t nw = (m_n + NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG;
+      std::vector<_ntl_ulong> c(nw, 0);
+      std::vector<_ntl_ulong> m(kw, 0);
 
-	  for(long int j = 0; static_cast<size_t> (j) < b.size() &&
-		static_cast<long int> (k) < m.length(); j++, k++)
-	    m[k] = b[static_cast<size_t> (j)];
-	}
+      mcnoodle::packMessage(&m[0], plaintext, plaintext_size);
 
       /*
-      ** Create the random vector e. It will contain at most t ones.
+      ** c = m * G, a row of G for every set bit of m.
       */
 
-      NTL::vec_GF2 e;
-      long int t = static_cast<long int> (m_t);
-      long int ts = 0;
-
-      e.SetLength(static_cast<long int> (m_n));
+      for(size_t i = 0; i < m_k; i++)
+	if((m[i / NTL_BITS_PER_LONG] >> (i % NTL_BITS_PER_LONG)) & 1)
+	  {
+	    const _ntl_ulong *row = m_G + i * m_words;
 
-      do
-	{
-	  long int i = NTL::RandomBnd(e.length());
+	    for(size_t j = 0; j < m_words; j++)
+	      c[j] ^= row[j];
+	  }
 
-	  if(e[i] == 0)
-	    {
-	      e[i] = 1;
-	      ts += 1;
-	    }
-	}
-      while(t > ts);
+      mcnoodle::prepareErrorVector(e, m_n, m_t);
 
-      NTL::vec_GF2 c = m * m_publicKey->Gcar() + e;
+      for(size_t i = 0; i < nw; i++)
+	c[i] ^= e.rep[static_cast<long int> (i)];
 
-      ciphertext << c;
+      mcnoodle::writeCiphertext(ciphertext, &c[0], m_n);
     }
   catch(...)
     {
-      ciphertext.clear();
       return false;
     }
 
   return true;
 }
 
-bool mcnoodle::generatePrivatePublicKeys(void)
+mcnoodle_decrypt_key::mcnoodle_decrypt_key(const char *path,
+					   const bool verify)
 {
-  delete m_privateKey;
-  m_privateKey = 0;
-  delete m_publicKey;
-  m_publicKey = 0;
-  m_privateKey = new (std::nothrow) mcnoodle_private_key(m_m, m_t);
+  m_P = 0;
+  m_Sinv = 0;
+  m_columns = 0;
+  m_context = 0;
+  m_k = 0;
+  m_n = 0;
+  m_ok = false;
+  m_preSynTab = 0;
+  m_stride = 0;
+  m_t = 0;
+  m_words = 0;
+
+  if(m_file.open(path, mcnoodle_key_file::s_privateKey, verify))
+    prepare();
+}
 
-  if(!m_privateKey)
-    return false;
+mcnoodle_decrypt_key::mcnoodle_decrypt_key(const mcnoodle &keys)
+{
+  m_P = 0;
+  m_Sinv = 0;
+  m_columns = 0;
+  m_context = 0;
+  m_k = 0;
+  m_n = 0;
+  m_ok = false;
+  m_preSynTab = 0;
+  m_stride = 0;
+  m_t = 0;
+  m_words = 0;
 
-  m_publicKey = new (std::nothrow) mcnoodle_public_key(m_m, m_t);
+  try
+    {
+      std::vector<unsigned char> image;
 
-  if(!m_publicKey)
+      if(keys.privateKeyFile(image) &&
+	 m_file.open(image, mcnoodle_key_file::s_privateKey))
+	prepare();
+    }
+  catch(...)
     {
-      delete m_privateKey;
-      m_privateKey = 0;
-      return false;
+      m_ok = false;
     }
+}
+
+mcnoodle_decrypt_key::~mcnoodle_decrypt_key()
+{
+}
+
+bool mcnoodle_decrypt_key::decrypt(const char *ciphertext,
+				   const size_t ciphertext_size,
+				   char *plaintext,
+				   size_t &plaintext_size) const
+{
+  mcnoodle_decrypt_workspace workspace;
+
+  return decrypt
+    (ciphertext, ciphertext_size, plaintext, plaintext_size, workspace);
+}
+
+bool mcnoodle_decrypt_key::decrypt(const char *ciphertext,
+				   const size_t ciphertext_size,
+				   char *plaintext,
+				   size_t &plaintext_size,
+				   mcnoodle_decrypt_workspace &workspace) const
+{
+  if(!m_ok || !ciphertext || ciphertext_size != ciphertextSize() ||
+     !plaintext)
+    return false;
 
   try
     {
-      if(!m_privateKey->ok() || !m_publicKey->ok())
-	throw std::exception();
+      if(!mcnoodle::readCiphertext(workspace.m_c, ciphertext, m_n))
+	return false;
 
       /*
-      ** Create the parity-check matrix H.
+      ** ccar = c * P^-1, ccar[i] = c[P[i]].
       */
 
-      NTL::GF2EX gZ = m_privateKey->gZ();
-      NTL::mat_GF2 H;
-      NTL::vec_GF2E L = m_privateKey->L();
-      long int m = static_cast<long int> (m_m);
-      long int n = static_cast<long int> (m_n);
-      long int t = static_cast<long int> (m_t);
-
-      H.SetDims(m * t, n);
+      NTL::vec_GF2 &ccar(workspace.m_ccar);
 
-      for(long int i = 0; i < t; i++)
-	for(long int j = 0; j < n; j++)
-	  {
-	    NTL::GF2E gf2e = NTL::inv(NTL::eval(gZ, L[j])) *
-	      NTL::power(L[j], i);
-	    NTL::vec_GF2 v = NTL::to_vec_GF2(gf2e._GF2E__rep);
-
-	    for(long int k = 0; k < v.length(); k++)
-	      H[i * m + k][j] = v[k];
-	  }
+      ccar.SetLength(static_cast<long int> (m_n));
+      gatherBits(ccar.rep.elts(), workspace.m_c.rep.elts(), m_P, m_n);
 
-      NTL::gauss(H);
+      if(!workspace.correct(m_context->field(),
+			    m_gZ,
+			    m_sqrtZ,
+			    m_L,
+			    m_preSynTab,
+			    m_stride,
+			    m_n,
+			    m_t))
+	return false;
 
-      /*
-      ** Reduced row echelon form.
-      */
+      NTL::vec_GF2 &m(workspace.m_m);
 
-      long int lead = 0;
+      m.SetLength(static_cast<long int> (m_k));
 
-      for(long int r = 0; r < H.NumRows(); r++)
+      if(m_Sinv)
 	{
-	  if(H.NumCols() <= lead)
-	    break;
+	  /*
+	  ** m = mcar * Sinv, a row of Sinv for every set bit of mcar.
+	  */
 
-	  long int i = r;
+	  NTL::vec_GF2 &mcar(workspace.m_mcar);
+	  _ntl_ulong *x = m.rep.elts();
 
-	  while(H[i][lead] == 0)
-	    {
-	      i += 1;
-
-	      if(H.NumRows() == i)
-		{
-		  i = r;
-		  lead += 1;
+	  mcar.SetLength(static_cast<long int> (m_k));
+	  gatherBits(mcar.rep.elts(), ccar.rep.elts(), m_columns, m_k);
+	  NTL::clear(m);
 
-		  if(H.NumCols() == lead)
-		    goto done_label;
-		}
-	    }
+	  const _ntl_ulong *y = mcar.rep.elts();
 
-	  NTL::swap(H[i], H[r]);
+	  for(size_t i = 0; i < m_k; i++)
+	    if((y[i / NTL_BITS_PER_LONG] >> (i % NTL_BITS_PER_LONG)) & 1)
+	      {
+		const _ntl_ulong *row = m_Sinv + i * m_words;
 
-	  if(H[r][lead] != 0)
-	    for(long int j = 0; j < H.NumCols(); j++)
-	      H[r][j] /= H[r][lead];
+		for(size_t j = 0; j < m_words; j++)
+		  x[j] ^= row[j];
+	      }
+	}
+      else
+	gatherBits(m.rep.elts(), ccar.rep.elts(), m_columns, m_k);
 
-	  for(long int j = 0; j < H.NumRows(); j++)
-	    if(j != r)
-	      H[j] = H[j] - H[j][lead] * H[r];
+      return mcnoodle::readMessage
+	(plaintext, plaintext_size, workspace, m_k);
+    }
+  catch(...)
+    {
+      return false;
+    }
+}
 
-	  lead += 1;
-	}
+void mcnoodle_decrypt_key::prepare(void)
+{
+  m_k = m_file.k();
+  m_n = m_file.n();
+  m_t = m_file.t();
+  m_stride = m_file.sectionSize(4) / (8 * m_n);
+  m_words = (m_k + NTL_BITS_PER_LONG - 1) / NTL_BITS_PER_LONG;
 
-    done_label:
+  try
+    {
+      const uint16_t *gZ = static_cast<const uint16_t *>
+	(m_file.section(0, 2 * (m_t + 1)));
+      const uint16_t *sqrtZ = static_cast<const uint16_t *>
+	(m_file.section(1, 2 * m_t));
+      const uint16_t *L = static_cast<const uint16_t *>
+	(m_file.section(2, 2 * m_n));
+
+      m_P = static_cast<const uint32_t *> (m_file.section(3, 4 * m_n));
+      m_preSynTab = static_cast<const uint64_t *>
+	(m_file.section(4, 8 * m_n * m_stride));
+      m_columns = static_cast<const uint32_t *>
+	(m_file.section(5, 4 * m_k));
+
+      if(!m_file.systematic())
+	{
+	  m_Sinv = static_cast<const _ntl_ulong *>
+	    (m_file.section(6, sizeof(_ntl_ulong) * m_k * m_words));
 
-      /*
-      ** H = [I|R], systematic form.
-      ** More information at https://en.wikipedia.org/wiki/Generator_matrix.
-      */
+	  if(!m_Sinv)
+	    return;
+	}
 
-      for(long int i = 0; i < H.NumRows(); i++)
-	if(H[i][i] == 0)
-	  {
-	    bool pivot = true;
+      if(!gZ || !sqrtZ || !L || !m_P || !m_preSynTab || !m_columns ||
+	 4 * m_stride < m_t || !isPermutation(m_P, m_n))
+	return;
 
-	    for(long int j = i + 1; j < H.NumCols(); j++)
-	      {
-		if(H[i][j] == 1)
-		  {
-		    for(long int k = i + 1; k < H.NumRows(); k++)
-		      if(H[k][j] == 1)
-			{
-			  pivot = false;
-			  break;
-			}
+      for(size_t i = 0; i < m_k; i++)
+	if(m_columns[i] >= m_n)
+	  return;
 
-		    if(!pivot)
-		      break;
+      m_context = mcnoodle_field_context::get(m_file.m());
 
-		    for(long int k = i - 1; k >= 0; k--)
-		      if(H[k][j] == 1)
-			{
-			  pivot = false;
-			  break;
-			}
-		  }
-		else
-		  continue;
-
-		if(pivot)
-		  {
-		    m_privateKey->swapSwappingColumns(i, j);
-		    break;
-		  }
-	      }
-	  }
+      if(!m_context || m_context->field().modulus() != m_file.modulus())
+	return;
 
-      NTL::mat_GF2 mat_GF2;
-      std::vector<long int> swappingColumns(m_privateKey->swappingColumns());
+      /*
+      ** The field's tables are indexed by the elements that the file
+      ** holds. L must be distinct elements, g(z) monic of degree t,
+      ** sqrt(z) of degree less than t, and the t coefficients of
+      ** every row of the syndrome table elements.
+      */
 
-      mat_GF2.SetDims(H.NumRows(), H.NumCols());
+      size_t order = static_cast<size_t> (1) << m_file.m();
+      std::vector<bool> support(order, false);
+      std::vector<uint64_t> mask(m_stride, 0);
 
-      for(long int i = 0; i < n; i++)
-	for(long int j = 0; j < m * t; j++)
-	  mat_GF2[j][i] = H[j][swappingColumns[i]];
+      for(size_t i = 0; i < m_n; i++)
+	if(L[i] >= order || support[L[i]])
+	  return;
+	else
+	  support[L[i]] = true;
 
-      H = mat_GF2;
+      if(gZ[m_t] != 1)
+	return;
 
-      NTL::mat_GF2 R;
+      for(size_t i = 0; i < m_t; i++)
+	if(gZ[i] >= order || sqrtZ[i] >= order)
+	  return;
 
-      R.SetDims(m * t, n - m * t); // R^T has n - mt rows and mt columns.
+      for(size_t j = 0; j < m_t; j++)
+	mask[j / 4] |= static_cast<uint64_t> (0xffff & ~(order - 1)) <<
+	  (16 * (j % 4));
 
-      for(long int i = 0; i < R.NumRows(); i++)
-	for(long int j = 0; j < R.NumCols(); j++)
-	  R[i][j] = H[i][j + m * t];
+      for(size_t i = 0; i < m_n * m_stride; i++)
+	if(m_preSynTab[i] & mask[i % m_stride])
+	  return;
 
-      R = NTL::transpose(R);
-      m_privateKey->prepareG(R);
-      m_publicKey->prepareGcar
-	(m_privateKey->G(), m_privateKey->P(), m_privateKey->S());
+      m_L.assign(L, L + m_n);
+      m_gZ.assign(gZ, gZ + m_t + 1);
+      m_sqrtZ.assign(sqrtZ, sqrtZ + m_t);
+      m_ok = true;
     }
   catch(...)
     {
-      delete m_privateKey;
-      m_privateKey = 0;
-      delete m_publicKey;
-      m_publicKey = 0;
-      return false;
+      m_ok = false;
     }
+}
 
-  return true;
+size_t mcnoodle_decrypt_key::residentSize(void) const
+{
+  return sizeof(*this) + m_file.size() +
+    sizeof(uint16_t) *
+    (m_L.capacity() + m_gZ.capacity() + m_sqrtZ.capacity());
 }
@@ -35,6 +35,7 @@
 extern "C"
 {
 #include <limits.h>
+#include <stdint.h>
 #include <string.h>
 }
 
@@ -49,96 +50,406 @@ extern "C"
 #include <NTL/vec_GF2E.h>
 #endif
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <limits>
+#include <map>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 
+/*
+** Table-driven arithmetic in GF(2^m), m <= 16. Elements are stored
+** in polynomial basis, bit i of an element being the coefficient
+** of x^i in its NTL::GF2E representation. Polynomials over GF(2^m)
+** are std::vector<uint16_t> objects, lowest coefficient first.
+*/
+
+class mcnoodle_gf2m
+{
+ public:
+  mcnoodle_gf2m(void);
+  ~mcnoodle_gf2m();
+  NTL::GF2E toGF2E(const uint16_t a) const;
+
+  bool ok(void) const
+  {
+    return m_ok;
+  }
+
+  bool polyInvMod(std::vector<uint16_t> &x,
+		  const std::vector<uint16_t> &a,
+		  const std::vector<uint16_t> &g) const;
+  bool polyInvMod(std::vector<uint16_t> &x,
+		  const std::vector<uint16_t> &a,
+		  const std::vector<uint16_t> &g,
+		  std::vector<uint16_t> &scratch) const;
+  bool polyIrreducible(const std::vector<uint16_t> &f) const;
+  bool polyRandomIrreducible(std::vector<uint16_t> &g,
+			     const size_t t,
+			     NTL::RandomStream &stream,
+			     size_t &attempts) const;
+  bool prepare(const NTL::GF2X &modulus);
+  static long int polyDeg(const std::vector<uint16_t> &a);
+
+  size_t m(void) const
+  {
+    return m_m;
+  }
+
+  uint32_t modulus(void) const
+  {
+    return m_modulus; // Bit i is the coefficient of x^i.
+  }
+
+  uint16_t inv(const uint16_t a) const
+  {
+    return a ? m_antilog[m_order - m_log[a]] : 0;
+  }
+
+  uint16_t mul(const uint16_t a, const uint16_t b) const
+  {
+    return a && b ? m_antilog[m_log[a] + m_log[b]] : 0;
+  }
+
+  uint16_t polyEval(const std::vector<uint16_t> &f, const uint16_t x) const;
+
+  uint16_t primitive(void) const
+  {
+    return m_antilog.size() > 1 ? m_antilog[1] : 0; // The tables' base.
+  }
+
+  uint16_t sq(const uint16_t a) const
+  {
+    return a ? m_antilog[2 * m_log[a]] : 0;
+  }
+
+  uint16_t sqrt(const uint16_t a) const
+  {
+    /*
+    ** The order is odd, so one of log(a) and log(a) + order is even.
+    */
+
+    if(!a)
+      return 0;
+    else if(m_log[a] & 1)
+      return m_antilog[(m_log[a] + m_order) / 2];
+    else
+      return m_antilog[m_log[a] / 2];
+  }
+
+  /*
+  ** The overloads taking a scratch vector do not allocate once the
+  ** scratch and the outputs have reached their working sizes.
+  */
+
+  void polyEvalFFT(std::vector<uint16_t> &y,
+		   const std::vector<uint16_t> &f) const;
+  void polyEvalFFT(std::vector<uint16_t> &y,
+		   const std::vector<uint16_t> &f,
+		   std::vector<uint16_t> &scratch) const;
+  void polyEvalSupport(std::vector<uint16_t> &y,
+		       const std::vector<uint16_t> &f,
+		       const std::vector<uint16_t> &L) const;
+  void polyEvalSupport(std::vector<uint16_t> &y,
+		       const std::vector<uint16_t> &f,
+		       const std::vector<uint16_t> &L,
+		       std::vector<uint16_t> &scratch) const;
+  void polyRem(std::vector<uint16_t> &a,
+	       const std::vector<uint16_t> &g) const;
+  void polySqrMod(std::vector<uint16_t> &x,
+		  const std::vector<uint16_t> &a,
+		  const std::vector<uint16_t> &g) const;
+  void polySqrtMod(std::vector<uint16_t> &x,
+		   const std::vector<uint16_t> &a,
+		   const std::vector<uint16_t> &g,
+		   const std::vector<uint16_t> &sqrtZ) const;
+  void polySqrtMod(std::vector<uint16_t> &x,
+		   const std::vector<uint16_t> &a,
+		   const std::vector<uint16_t> &g,
+		   const std::vector<uint16_t> &sqrtZ,
+		   std::vector<uint16_t> &scratch) const;
+
+ private:
+  static const long int s_frobeniusDivisor = 8;
+  bool m_ok;
+  size_t m_m;
+  size_t m_order; // 2^m - 1
+  std::vector<uint16_t> m_antilog; // Two periods and zeros.
+  std::vector<uint16_t> m_log;
+  uint32_t m_modulus;
+  bool polyCoprime(const std::vector<uint16_t> &a,
+		   const std::vector<uint16_t> &b) const;
+  static long int degree(const uint16_t *a, const long int n);
+  size_t evalFFTScratchSize(const long int df) const;
+  static size_t fftScratchSize(const long int df, const size_t d);
+  uint32_t mulSlow(const uint32_t a, const uint32_t b) const;
+  void evalFFT(uint16_t *y,
+	       const std::vector<uint16_t> &f,
+	       uint16_t *scratch) const;
+  void fft(uint16_t *y,
+	   uint16_t *f,
+	   const long int df,
+	   const uint16_t *beta,
+	   const size_t d,
+	   uint16_t *scratch) const;
+};
+
+/*
+** What GF(2^m) contributes to every key of that m: NTL's irreducible
+** modulus, the field's tables over it, a primitive element a and
+** the support L = (0, a, a^2, ..., a^(n - 1)). A context is built on
+** the first get() of its m and then shared, unchanged, by the whole
+** process. get() returns zero for an m out of range.
+*/
+
+class mcnoodle_field_context
+{
+ public:
+  static const mcnoodle_field_context *get(const size_t m);
+
+  const NTL::GF2X &modulus(void) const
+  {
+    return m_modulus;
+  }
+
+  const mcnoodle_gf2m &field(void) const
+  {
+    return m_field;
+  }
+
+  const std::vector<uint16_t> &L(void) const
+  {
+    return m_L;
+  }
+
+ private:
+  NTL::GF2X m_modulus;
+  mcnoodle_gf2m m_field;
+  std::vector<uint16_t> m_L;
+  mcnoodle_field_context(void);
+  ~mcnoodle_field_context();
+  bool prepare(const size_t m);
+};
+
+/*
+** A permutation of {0, ..., n - 1} and its inverse. As a matrix,
+** row i of P has its one in column forward()[i].
+*/
+
+class mcnoodle_permutation
+{
+ public:
+  mcnoodle_permutation(void);
+  ~mcnoodle_permutation();
+  bool prepare(const size_t n, NTL::RandomStream &stream);
+  bool prepare(const std::vector<uint32_t> &forward);
+
+  const std::vector<uint32_t> &forward(void) const
+  {
+    return m_forward;
+  }
+
+  const std::vector<uint32_t> &inverse(void) const
+  {
+    return m_inverse;
+  }
+
+  size_t size(void) const
+  {
+    return m_forward.size();
+  }
+
+  void apply(NTL::vec_GF2 &x, const NTL::vec_GF2 &a) const;
+  void applyColumns(NTL::mat_GF2 &X, const NTL::mat_GF2 &A) const;
+  void applyInverse(NTL::vec_GF2 &x, const NTL::vec_GF2 &a) const;
+
+ private:
+  std::vector<uint32_t> m_forward;
+  std::vector<uint32_t> m_inverse;
+};
+
+/*
+** Scratch space for mcnoodle::decrypt(). A workspace that has served
+** one decryption serves every later decryption under keys of the same
+** size without touching the heap. Not to be shared between threads.
+*/
+
+class mcnoodle_decrypt_workspace
+{
+ public:
+  mcnoodle_decrypt_workspace(void);
+  ~mcnoodle_decrypt_workspace();
+
+ private:
+  NTL::vec_GF2 m_c;
+  NTL::vec_GF2 m_ccar;
+  NTL::vec_GF2 m_m;
+  NTL::vec_GF2 m_mcar;
+  std::vector<char> m_plaintext;
+  std::vector<uint16_t> m_T;
+  std::vector<uint16_t> m_r0;
+  std::vector<uint16_t> m_r1;
+  std::vector<uint16_t> m_scratch;
+  std::vector<uint16_t> m_sigma;
+  std::vector<uint16_t> m_syndrome;
+  std::vector<uint16_t> m_tau;
+  std::vector<uint16_t> m_u0;
+  std::vector<uint16_t> m_u1;
+  std::vector<uint16_t> m_y;
+  std::vector<uint64_t> m_words;
+  bool correct(const mcnoodle_gf2m &field,
+	       const std::vector<uint16_t> &gZ,
+	       const std::vector<uint16_t> &sqrtZ,
+	       const std::vector<uint16_t> &L,
+	       const uint64_t *v,
+	       const size_t stride,
+	       const size_t size,
+	       const size_t errors);
+  friend class mcnoodle;
+  friend class mcnoodle_decrypt_key;
+};
+
 class mcnoodle_private_key
 {
  public:
   mcnoodle_private_key(const size_t m, const size_t t);
   ~mcnoodle_private_key();
 
-  NTL::GF2EX X(void) const
+  const NTL::mat_GF2 &R(void) const
+  {
+    /*
+    ** Row j of G, in the column order of swappingColumns(), is row j
+    ** of R followed by e_j. G itself is never formed.
+    */
+
+    return m_R;
+  }
+
+  const NTL::mat_GF2 &S(void) const
   {
-    return m_X;
+    return m_S;
   }
 
-  NTL::GF2EX gZ(void) const
+  const NTL::mat_GF2 &Sinv(void) const
   {
-    return m_gZ;
+    return m_Sinv;
   }
 
-  NTL::mat_GF2 G(void) const
+  bool ok(void) const
   {
-    return m_G;
+    return m_ok;
   }
 
-  NTL::mat_GF2 P(void) const
+  bool prepareG(const NTL::mat_GF2 &H);
+  bool prepareGoppaCode(NTL::RandomStream &stream);
+  bool prepareMessageColumns(const mcnoodle_permutation &Q);
+  bool prepareSwappingColumns(const NTL::vec_long &pivots);
+  void releaseGcarFactors(void);
+
+  /*
+  ** The stages below are independent of one another and of the
+  ** stages above, and may run concurrently with them. They leave
+  ** ok() alone, the caller checks their results.
+  */
+
+  bool prepareP(NTL::RandomStream &stream);
+  bool preparePreSynTab(const size_t threads);
+  bool prepareS(NTL::RandomStream &stream, const size_t blockRows);
+
+  const mcnoodle_permutation &P(void) const
   {
     return m_P;
   }
 
-  NTL::mat_GF2 Pinv(void) const
+  const mcnoodle_gf2m &field(void) const
   {
-    return m_Pinv;
+    return m_context->field();
   }
 
-  NTL::mat_GF2 S(void) const
+  const uint64_t *preSynTab(void) const
   {
-    return m_S;
+    /*
+    ** Row i holds the t coefficients of 1 / (X - L[i]) mod g(z),
+    ** four per word, coefficient j in bits 16 * (j % 4) of word
+    ** j / 4. Rows are preSynTabStride() words apart and start on
+    ** a cache-line boundary.
+    */
+
+    if(m_preSynTab.empty())
+      return 0;
+
+    const uint64_t *p = &m_preSynTab[0];
+    uintptr_t misalignment = reinterpret_cast<uintptr_t> (p) % 64;
+
+    return misalignment ? p + (64 - misalignment) / sizeof(*p) : p;
   }
 
-  NTL::mat_GF2 Sinv(void) const
+  size_t gZAttempts(void) const
   {
-    return m_Sinv;
+    return m_gZAttempts; // Polynomials drawn for g(z).
   }
 
-  NTL::vec_GF2E L(void) const
+  size_t preSynTabStride(void) const
   {
-    return m_L;
+    return m_preSynTabStride;
   }
 
-  bool ok(void) const
+  const std::vector<uint16_t> &L(void) const
   {
-    return m_ok;
+    return m_context->L();
   }
 
-  bool prepareG(const NTL::mat_GF2 &R);
+  const std::vector<uint16_t> &gZ16(void) const
+  {
+    return m_gZ16;
+  }
 
-  std::vector<NTL::GF2EX> preSynTab(void) const
+  const std::vector<uint16_t> &sqrtZ(void) const
   {
-    return m_preSynTab;
+    return m_sqrtZ;
   }
 
-  std::vector<long int> swappingColumns(void) const
+  const std::vector<long int> &swappingColumns(void) const
   {
     return m_swappingColumns;
   }
 
-  void swapSwappingColumns(const long int i, const long int j);
+  const std::vector<uint32_t> &messageColumns(void) const
+  {
+    /*
+    ** Empty unless the public key is systematic. Otherwise, bit i
+    ** of the message is bit messageColumns()[i] of a corrected
+    ** ciphertext in the private coordinates.
+    */
+
+    return m_messageColumns;
+  }
 
  private:
-  NTL::GF2EX m_X;
-  NTL::GF2EX m_gZ;
-  NTL::mat_GF2 m_G;
-  NTL::mat_GF2 m_P;
-  NTL::mat_GF2 m_Pinv;
+  static const size_t s_preSynTabRows = 64;
+  NTL::mat_GF2 m_R;
   NTL::mat_GF2 m_S;
   NTL::mat_GF2 m_Sinv;
-  NTL::vec_GF2E m_L;
   bool m_ok;
+  const mcnoodle_field_context *m_context;
+  mcnoodle_permutation m_P;
+  size_t m_gZAttempts;
   size_t m_k;
   size_t m_m;
   size_t m_n;
+  size_t m_preSynTabStride;
   size_t m_t;
-  std::vector<NTL::GF2EX> m_preSynTab;
   std::vector<long int> m_swappingColumns;
-  bool prepareP(void);
-  bool preparePreSynTab(void);
-  bool prepareS(void);
-  bool prepare_gZ(void);
-  void prepareSwappingColumns(void);
+  std::vector<uint32_t> m_messageColumns;
+  std::vector<uint64_t> m_preSynTab; // Over-allocated, see preSynTab().
+  std::vector<uint16_t> m_gZ16;
+  std::vector<uint16_t> m_sqrtZ;
+  bool prepareSqrtZ(void);
+  bool prepare_gZ(NTL::RandomStream &stream);
 };
 
 class mcnoodle_public_key
@@ -147,36 +458,184 @@ class mcnoodle_public_key
   mcnoodle_public_key(const size_t m, const size_t t);
   ~mcnoodle_public_key();
 
-  NTL::mat_GF2 Gcar(void) const
+  const NTL::mat_GF2 &Gcar(void) const
   {
     return m_Gcar;
   }
 
+  /*
+  ** A systematic public key keeps the k x (n - k) block R of
+  ** [I|R] * Q, a row reduction of Gcar, and releases Gcar. The
+  ** codeword of m is then [m|m * R] * Q.
+  */
+
+  const NTL::mat_GF2 &R(void) const
+  {
+    return m_R;
+  }
+
   bool ok(void) const
   {
     return m_ok;
   }
 
-  bool prepareGcar(const NTL::mat_GF2 &G,
-		   const NTL::mat_GF2 &P,
-		   const NTL::mat_GF2 &S);
+  bool prepareGcar(const NTL::mat_GF2 &R,
+		   const std::vector<long int> &swappingColumns,
+		   const mcnoodle_permutation &P,
+		   const NTL::mat_GF2 &S,
+		   const size_t blockRows);
+  bool prepareSystematic(void);
+
+  bool systematic(void) const
+  {
+    return m_systematic;
+  }
+
+  const mcnoodle_permutation &Q(void) const
+  {
+    return m_Q;
+  }
 
  private:
   NTL::mat_GF2 m_Gcar;
+  NTL::mat_GF2 m_R;
   bool m_ok;
+  bool m_systematic;
+  mcnoodle_permutation m_Q;
   size_t m_t;
 };
 
+/*
+** Warning: a systematic key places the message bits in the clear,
+** at positions Q^-1[0..k) of the codeword, masked only by the t
+** errors. Until messages are randomized first by a CCA2 conversion,
+** such as that of Kobara and Imai, systematic keys may be generated,
+** written and loaded, and may decrypt, but every encryption with
+** them fails.
+*/
+
 class mcnoodle
 {
  public:
   mcnoodle(const size_t m, const size_t t);
+  mcnoodle(const size_t m, const size_t t, const bool systematic);
   ~mcnoodle();
+  bool decrypt(const char *ciphertext,
+	       const size_t ciphertext_size,
+	       char *plaintext,
+	       size_t &plaintext_size) const;
+  bool decrypt(const char *ciphertext,
+	       const size_t ciphertext_size,
+	       char *plaintext,
+	       size_t &plaintext_size,
+	       mcnoodle_decrypt_workspace &workspace) const;
   bool decrypt(const std::stringstream &ciphertext,
 	       std::stringstream &plaintext) const;
+  bool decrypt(const std::stringstream &ciphertext,
+	       std::stringstream &plaintext,
+	       mcnoodle_decrypt_workspace &workspace) const;
+  bool decryptBatch(const char *ciphertexts,
+		    const size_t count,
+		    char *plaintexts,
+		    size_t *plaintext_sizes,
+		    bool *results,
+		    const size_t threads) const;
+  bool encrypt(const char *plaintext, const size_t plaintext_size,
+	       char *ciphertext, const size_t ciphertext_size) const;
   bool encrypt(const char *plaintext, const size_t plaintext_size,
 	       std::stringstream &ciphertext) const;
+  bool encryptBatch(const char *plaintexts,
+		    const size_t *plaintext_sizes,
+		    const size_t count,
+		    char *ciphertexts) const;
+  bool generatePrivatePublicKeys(const unsigned char *seed);
   bool generatePrivatePublicKeys(void);
+  size_t keygenMemory(void) const;
+  void setKeygenThreads(const size_t threads);
+  void setMemoryBudget(const size_t bytes);
+  bool writePrivateKey(const char *path) const;
+  bool writePublicKey(const char *path) const;
+
+  /*
+  ** Wall-clock seconds spent in each stage of the last
+  ** generatePrivatePublicKeys(), and in the whole of it under
+  ** "total". Stages on different threads overlap. "goppa attempts"
+  ** is the number of polynomials drawn for g(z) and "code attempts"
+  ** the number of codes drawn until H had full rank, not times.
+  */
+
+  const std::map<std::string, double> &keygenTimes(void) const
+  {
+    return m_keygenTimes;
+  }
+
+  /*
+  ** keygenMemory() is an upper bound on the bytes that
+  ** generatePrivatePublicKeys() holds at once. With a budget from
+  ** setMemoryBudget(), keygen forms its products in row blocks sized
+  ** to fit it, and fails before allocating if the bound still
+  ** exceeds it. Zero, the default, is no budget. Memory that the
+  ** allocator keeps after it is freed is not counted.
+  */
+
+  size_t memoryBudget(void) const
+  {
+    return m_memoryBudget;
+  }
+
+  /*
+  ** Keygen's stages run on threads of their own, and the syndrome
+  ** table is filled by setKeygenThreads() threads, or by one per core
+  ** if zero, the default.
+  */
+
+  size_t keygenThreads(void) const
+  {
+    return m_keygenThreads;
+  }
+
+  /*
+  ** The binary ciphertext is a big-endian header holding n followed
+  ** by the n bits of the codeword, packed eight to a byte, least
+  ** significant bit first. Its message carries a big-endian length
+  ** ahead of the plaintext, so plaintexts may contain NULs.
+  **
+  ** decryptBatch() decrypts count binary ciphertexts laid end to end
+  ** on threads workers, or one per core if threads is zero. A
+  ** ciphertext that fails has its result set to false and its size
+  ** to zero; results may be null. Returns true if all succeeded.
+  **
+  ** encryptBatch() encrypts count plaintexts, plaintext i beginning
+  ** at i * maximumPlaintextSize(), into count binary ciphertexts laid
+  ** end to end.
+  */
+
+  size_t ciphertextSize(void) const
+  {
+    return s_headerSize + m_n / CHAR_BIT;
+  }
+
+  size_t maximumPlaintextSize(void) const
+  {
+    return m_k / CHAR_BIT - s_lengthSize;
+  }
+
+  /*
+  ** Keys are derived from a seed of seedSize() bytes alone. The
+  ** overload without a seed draws one from NTL's global stream. The
+  ** same seed, m, t and systematic flag give the same keys bit for
+  ** bit, so seed() is all of a key pair that need be stored.
+  */
+
+  const std::vector<unsigned char> &seed(void) const
+  {
+    return m_seed;
+  }
+
+  static size_t seedSize(void)
+  {
+    return s_seedSize;
+  }
 
   static size_t minimumM(const size_t m)
   {
@@ -202,12 +661,317 @@ class mcnoodle
   }
 
  private:
+  static const size_t s_batchSize = 8;
+  static const size_t s_blockRows = 4096;
+  static const size_t s_codeAttempts = 8;
+  static const size_t s_headerSize = 4;
+  static const size_t s_lengthSize = 2;
+  static const size_t s_seedSize = 32;
+  bool m_systematic;
   mcnoodle_private_key *m_privateKey;
   mcnoodle_public_key *m_publicKey;
   size_t m_k;
+  size_t m_keygenThreads;
   size_t m_m;
+  size_t m_memoryBudget;
   size_t m_n;
   size_t m_t;
+  std::map<std::string, double> m_keygenTimes;
+  std::vector<unsigned char> m_seed;
+  bool decryptVector(mcnoodle_decrypt_workspace &workspace) const;
+  bool encryptVector(NTL::vec_GF2 &c, const NTL::vec_GF2 &m) const;
+  size_t keygenBlockRows(void) const;
+  size_t keygenMemory(const size_t blockRows) const;
+  bool privateKeyFile(std::vector<unsigned char> &file) const;
+  static bool readCiphertext(NTL::vec_GF2 &c,
+			     const char *ciphertext,
+			     const size_t n);
+  static bool readMessage(char *plaintext,
+			  size_t &plaintext_size,
+			  mcnoodle_decrypt_workspace &workspace,
+			  const size_t k);
+  static void packMessage(_ntl_ulong *x,
+			  const char *plaintext,
+			  const size_t plaintext_size);
+  static void prepareErrorVector(NTL::vec_GF2 &e,
+				 const size_t n,
+				 const size_t t);
+  static void writeCiphertext(char *ciphertext,
+			      const _ntl_ulong *c,
+			      const size_t n);
+  friend class mcnoodle_decrypt_key;
+  friend class mcnoodle_encrypt_key;
+};
+
+/*
+** Key files. A key file is a header followed by up to eight
+** sections, each starting on a 64-byte boundary, in the machine's
+** own byte order and word size so that it may be used as mapped.
+** The header holds a magic string, a version, the key's type, the
+** word size, a byte-order mark, m, t, n, k, the field's modulus,
+** the file's size, the offset and size of every section, and
+** checksums of the sections and of the header itself.
+**
+** A public key file holds Gcar, k rows of n bits, or, if it is
+** systematic, the k rows of R followed by Q^-1.
+**
+** A private key file holds g(z), sqrt(z) mod g(z), L, P, the
+** syndrome table, the k columns of the corrected codeword that carry
+** the message, and, unless the key is systematic, Sinv. It is
+** written with mode 0600.
+**
+** Rows of bits are whole words apart. Permutations and columns are
+** uint32_t arrays and field elements are uint16_t arrays.
+*/
+
+class mcnoodle_key_file
+{
+ public:
+  static const uint32_t s_privateKey = 2;
+  static const uint32_t s_publicKey = 1;
+  static const uint32_t s_version = 1;
+  mcnoodle_key_file(void);
+  ~mcnoodle_key_file();
+
+  bool systematic(void) const
+  {
+    return m_systematic;
+  }
+
+  /*
+  ** Maps path read-only and shared, and checks its header. The
+  ** sections' checksum is verified only if verify is true, as it
+  ** reads every page of the file.
+  */
+
+  bool open(const char *path, const uint32_t type, const bool verify);
+
+  /*
+  ** Copies image, a key file laid out in memory, to a 64-byte
+  ** boundary of storage of its own, and checks its header.
+  */
+
+  bool open(const std::vector<unsigned char> &image, const uint32_t type);
+
+  /*
+  ** Section i, or zero unless it holds exactly size bytes.
+  */
+
+  const void *section(const size_t i, const size_t size) const;
+
+  size_t k(void) const
+  {
+    return m_k;
+  }
+
+  size_t m(void) const
+  {
+    return m_m;
+  }
+
+  size_t n(void) const
+  {
+    return m_n;
+  }
+
+  size_t sectionSize(const size_t i) const;
+
+  size_t size(void) const
+  {
+    return m_size;
+  }
+
+  size_t t(void) const
+  {
+    return m_t;
+  }
+
+  uint32_t modulus(void) const
+  {
+    return m_modulus;
+  }
+
+ private:
+  bool m_systematic;
+  const unsigned char *m_data;
+  size_t m_k;
+  size_t m_m;
+  size_t m_n;
+  size_t m_size;
+  size_t m_t;
+  std::vector<unsigned char> m_image;
+  uint32_t m_modulus;
+  mcnoodle_key_file(const mcnoodle_key_file &);
+  mcnoodle_key_file &operator=(const mcnoodle_key_file &);
+  bool check(const uint32_t type, const bool verify);
+  void close(void);
+};
+
+/*
+** Encryption with a mapped public key file. Its ciphertexts are
+** those of mcnoodle::encrypt(). The mapping is shared by every
+** process that maps the same file. A systematic public key file,
+** whose Q^-1 must be a permutation, is loaded but refuses to
+** encrypt, as mcnoodle does.
+*/
+
+class mcnoodle_encrypt_key
+{
+ public:
+  mcnoodle_encrypt_key(const char *path, const bool verify);
+  ~mcnoodle_encrypt_key();
+  bool encrypt(const char *plaintext, const size_t plaintext_size,
+	       char *ciphertext, const size_t ciphertext_size) const;
+
+  bool ok(void) const
+  {
+    return m_ok;
+  }
+
+  size_t ciphertextSize(void) const
+  {
+    return mcnoodle::s_headerSize + m_n / CHAR_BIT;
+  }
+
+  size_t maximumPlaintextSize(void) const
+  {
+    return m_k / CHAR_BIT - mcnoodle::s_lengthSize;
+  }
+
+ private:
+  bool m_ok;
+  const _ntl_ulong *m_G;
+  const uint32_t *m_Qinverse;
+  mcnoodle_key_file m_file;
+  size_t m_k;
+  size_t m_n;
+  size_t m_t;
+  size_t m_words;
+};
+
+/*
+** Decryption with a mapped private key file. The field is the shared
+** context of the file's m, whose modulus the file must carry. Only
+** the few short arrays that the polynomial arithmetic takes as
+** vectors are copied; the syndrome table, P and Sinv are used where
+** they lie. A file whose arrays are not elements, permutations and
+** polynomials of the right kinds is rejected, as is a bad header.
+**
+** A key may also be compacted from an mcnoodle object with keys. It
+** then holds the image of the object's private key file in one
+** aligned block of its own, and nothing of keygen. The object may
+** be destroyed afterwards.
+*/
+
+class mcnoodle_decrypt_key
+{
+ public:
+  mcnoodle_decrypt_key(const char *path, const bool verify);
+  mcnoodle_decrypt_key(const mcnoodle &keys);
+  ~mcnoodle_decrypt_key();
+  bool decrypt(const char *ciphertext,
+	       const size_t ciphertext_size,
+	       char *plaintext,
+	       size_t &plaintext_size) const;
+  bool decrypt(const char *ciphertext,
+	       const size_t ciphertext_size,
+	       char *plaintext,
+	       size_t &plaintext_size,
+	       mcnoodle_decrypt_workspace &workspace) const;
+
+  bool ok(void) const
+  {
+    return m_ok;
+  }
+
+  size_t ciphertextSize(void) const
+  {
+    return mcnoodle::s_headerSize + m_n / CHAR_BIT;
+  }
+
+  size_t maximumPlaintextSize(void) const
+  {
+    return m_k / CHAR_BIT - mcnoodle::s_lengthSize;
+  }
+
+  /*
+  ** The bytes that the key holds: the object, its key file, whether
+  ** mapped or its own, and the arrays copied out of the file.
+  */
+
+  size_t residentSize(void) const;
+
+ private:
+  bool m_ok;
+  const _ntl_ulong *m_Sinv;
+  const uint32_t *m_P;
+  const uint32_t *m_columns;
+  const mcnoodle_field_context *m_context;
+  const uint64_t *m_preSynTab;
+  mcnoodle_key_file m_file;
+  size_t m_k;
+  size_t m_n;
+  size_t m_stride;
+  size_t m_t;
+  size_t m_words;
+  std::vector<uint16_t> m_L;
+  std::vector<uint16_t> m_gZ;
+  std::vector<uint16_t> m_sqrtZ;
+  mcnoodle_decrypt_key(const mcnoodle_decrypt_key &);
+  mcnoodle_decrypt_key &operator=(const mcnoodle_decrypt_key &);
+  void prepare(void);
+};
+
+/*
+** Ready mcnoodle objects of one (m, t), their keys generated ahead
+** of time by threads workers, or one per core if threads is zero.
+** The workers keep up to capacity objects in the pool. They share
+** the cores, so each keygen fills its syndrome table on the cores
+** divided by the workers, one at least.
+**
+** acquire() never waits. It hands over the oldest ready object,
+** which the caller then owns and deletes, or returns zero if the
+** pool is empty; the latter counts as a stall. The destructor lets
+** keygens in progress finish and deletes the objects left over.
+**
+** statistics() reports "acquired", "capacity", "depth", "failures",
+** "generated", "stalls" and "threads", the mean seconds of a keygen
+** under "keygen seconds", and keys generated per second since the
+** pool was created under "refill rate".
+*/
+
+class mcnoodle_key_pool
+{
+ public:
+  mcnoodle_key_pool(const size_t m,
+		    const size_t t,
+		    const size_t capacity,
+		    const size_t threads,
+		    const bool systematic = false);
+  ~mcnoodle_key_pool();
+  mcnoodle *acquire(void);
+  size_t depth(void) const;
+  std::map<std::string, double> statistics(void) const;
+
+ private:
+  bool m_stop;
+  bool m_systematic;
+  double m_keygenSeconds;
+  mutable std::mutex m_mutex;
+  size_t m_acquired;
+  size_t m_capacity;
+  size_t m_failures;
+  size_t m_generated;
+  size_t m_keygenThreads;
+  size_t m_m;
+  size_t m_pending;
+  size_t m_stalls;
+  size_t m_t;
+  std::chrono::steady_clock::time_point m_start;
+  std::condition_variable m_condition;
+  std::deque<mcnoodle *> m_keys;
+  std::vector<std::thread> m_threads;
+  void refill(void);
 };
 
 #endif
@@ -90,6 +90,22 @@ int main()
 
       if (X1 != X) TerminalError("BitMatTest NOT OK!!");
 
+      mat_GF2 G;
+      vec_long pivots;
+
+      G = A;
+      long r = GaussJordan(G, pivots);
+
+      if (r != X.NumRows() || pivots.length() != r)
+         TerminalError("BitMatTest NOT OK!!");
+
+      long j, k;
+
+      for (j = 0; j < r; j++)
+         for (k = 0; k < n; k++)
+            if (G[k][pivots[j]] != to_GF2(j == k))
+               TerminalError("BitMatTest NOT OK!!");
+
       cerr << "\n";
    }
 
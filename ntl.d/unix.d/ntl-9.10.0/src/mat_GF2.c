@@ -5,6 +5,8 @@
 
 #include <NTL/new.h>
 
+#include <NTL/BasicThreadPool.h>
+
 NTL_START_IMPL
 
 
@@ -108,6 +110,24 @@ void mul(vec_GF2& x, const vec_GF2& a, const mat_GF2& B)
       mul_aux(x, a, B);
 }
   
+// Method of the Four Russians for multiplication (M4RM).
+//
+// B is taken one word of rows at a time, NTL_M4RM_TABLES groups of
+// NTL_M4RM_K rows.  For each group a table of all 2^NTL_M4RM_K sums
+// of its rows is built in Gray code order, so that each entry is one
+// row XOR from the previous one.  Every row of X then adds one entry
+// of each table, picked by the bytes of the matching word of A.  The
+// tables cover NTL_M4RM_BLOCK words of columns, which keeps all of
+// them in the L2 cache while the rows of A stream past.  The column
+// blocks are independent; with NTL_THREAD_BOOST they are shared out
+// among the threads, each with its own tables.
+
+#define NTL_M4RM_K (8)
+#define NTL_M4RM_TABLES (NTL_BITS_PER_LONG/NTL_M4RM_K)
+#define NTL_M4RM_BLOCK (16)
+
+#define PAR_THRESH (1000000.0)
+
 void mul_aux(mat_GF2& X, const mat_GF2& A, const mat_GF2& B)  
 {  
    long n = A.NumRows();  
@@ -118,12 +138,98 @@ void mul_aux(mat_GF2& X, const mat_GF2& A, const mat_GF2& B)
       LogicError("matrix mul: dimension mismatch");  
   
    X.SetDims(n, m);  
-  
-   long i;  
-  
-   for (i = 1; i <= n; i++) {  
-      mul_aux(X(i), A(i), B);
-   }  
+   clear(X);
+
+   long lw = (l + NTL_BITS_PER_LONG - 1)/NTL_BITS_PER_LONG;
+   long mw = (m + NTL_BITS_PER_LONG - 1)/NTL_BITS_PER_LONG;
+   long nblocks = (mw + NTL_M4RM_BLOCK - 1)/NTL_M4RM_BLOCK;
+
+   const bool seq = double(n)*double(l)*double(mw) < PAR_THRESH;
+
+   NTL_GEXEC_RANGE(seq, nblocks, first, last) {
+
+      const long tsize = (1L << NTL_M4RM_K)*NTL_M4RM_BLOCK;
+
+      Vec<_ntl_ulong> table;
+      table.SetLength(NTL_M4RM_TABLES*tsize);
+
+      const _ntl_ulong mask = (1UL << NTL_M4RM_K) - 1;
+      const _ntl_ulong *y[NTL_M4RM_TABLES];
+
+      for (long b = first; b < last; b++) {
+         long w0 = b*NTL_M4RM_BLOCK;
+         long bw = min(long(NTL_M4RM_BLOCK), mw - w0);
+
+         for (long wa = 0; wa < lw; wa++) {
+            long r0 = wa*NTL_BITS_PER_LONG;
+            long kt = (min(long(NTL_BITS_PER_LONG), l - r0) +
+                       NTL_M4RM_K - 1)/NTL_M4RM_K;
+
+            for (long q = 0; q < kt; q++) {
+               _ntl_ulong *t = table.elts() + q*tsize;
+               long r = r0 + q*NTL_M4RM_K;
+               long kk = min(long(NTL_M4RM_K), l - r);
+               long g = 0;
+
+               for (long j = 0; j < bw; j++)
+                  t[j] = 0;
+
+               // Entries past 2^kk stay unused: the bits of A past
+               // column l are zero.
+
+               for (long s = 1; s < (1L << kk); s++) {
+                  long low = s & -s;
+                  long h;
+
+                  for (h = 0; (1L << h) != low; h++) ;
+
+                  _ntl_ulong *x = t + (g ^ low)*NTL_M4RM_BLOCK;
+                  const _ntl_ulong *u = t + g*NTL_M4RM_BLOCK;
+                  const _ntl_ulong *z = B[r + h].rep.elts() + w0;
+
+                  for (long j = 0; j < bw; j++)
+                     x[j] = u[j] ^ z[j];
+
+                  g ^= low;
+               }
+            }
+
+            for (long i = 0; i < n; i++) {
+               _ntl_ulong a = A[i].rep.elts()[wa];
+
+               if (!a)
+                  continue;
+
+               _ntl_ulong *x = X[i].rep.elts() + w0;
+
+               if (kt == NTL_M4RM_TABLES) {
+                  for (long q = 0; q < NTL_M4RM_TABLES; q++)
+                     y[q] = table.elts() + q*tsize + 
+                        ((a >> (q*NTL_M4RM_K)) & mask)*NTL_M4RM_BLOCK;
+
+                  for (long j = 0; j < bw; j++) {
+                     _ntl_ulong w = x[j];
+
+                     for (long q = 0; q < NTL_M4RM_TABLES; q++)
+                        w ^= y[q][j];
+
+                     x[j] = w;
+                  }
+               }
+               else {
+                  for (long q = 0; q < kt; q++) {
+                     const _ntl_ulong *u = table.elts() + q*tsize +
+                        ((a >> (q*NTL_M4RM_K)) & mask)*NTL_M4RM_BLOCK;
+
+                     for (long j = 0; j < bw; j++)
+                        x[j] ^= u[j];
+                  }
+               }
+            }
+         }
+      }
+
+   } NTL_GEXEC_RANGE_END
 }  
   
   
@@ -152,69 +258,192 @@ void ident(mat_GF2& X, long n)
 } 
 
 
-void determinant(ref_GF2 d, const mat_GF2& M_in)
+// Method of the Four Russians (M4RI).
+//
+// Columns are taken NTL_M4RI_K at a time.  Up to NTL_M4RI_K pivot
+// rows are found in a strip by ordinary elimination and reduced
+// against each other, so they form an identity on their pivot
+// columns.  A table of all 2^kk sums of the kk pivot rows is then
+// built, each entry one row XOR from a smaller entry, and every other
+// row is cleared on the pivot columns with a single table lookup.
+// The table is built and applied NTL_M4RI_BLOCK words at a time so
+// that it stays in the L1 cache.
+//
+// Only the first w columns are reduced.  If full is set, the rows
+// above each strip are cleared too, which gives the reduced row
+// echelon form.  The return value is the rank of the first w
+// columns.  If pivots is not null, it receives the pivot column of
+// each of the first rank rows, recorded as the pivots are found.
+
+#define NTL_M4RI_K (8)
+#define NTL_M4RI_BLOCK (16)
+
+static
+long M4RI(mat_GF2& M, long w, long full, vec_long *pivots = 0)
 {
-   long k, n;
-   long i, j;
-   long pos;
+   long n = M.NumRows();
+   long m = M.NumCols();
 
-   n = M_in.NumRows();
+   if (w < 0 || w > m)
+      LogicError("gauss: bad args");
 
-   if (M_in.NumCols() != n)
-      LogicError("determinant: nonsquare matrix");
+   if (pivots)
+      pivots->SetLength(min(n, w));
 
-   if (n == 0) {
-      set(d);
-      return;
-   }
+   long wm = (m + NTL_BITS_PER_LONG - 1)/NTL_BITS_PER_LONG;
 
-   mat_GF2 M;
+   Vec<_ntl_ulong> table;
+   table.SetLength((1L << NTL_M4RI_K)*NTL_M4RI_BLOCK);
 
-   M = M_in;
+   vec_long index;
+   index.SetLength(n);
 
-   long wn = (n + NTL_BITS_PER_LONG - 1)/NTL_BITS_PER_LONG;
+   long pw[NTL_M4RI_K];
+   _ntl_ulong pmask[NTL_M4RI_K];
 
-   for (k = 0; k < n; k++) {
-      long wk = k/NTL_BITS_PER_LONG;
-      long bk = k - wk*NTL_BITS_PER_LONG;
-      _ntl_ulong k_mask = 1UL << bk;
+   long c, i, j, l, q, s;
+   long r = 0;
 
-      pos = -1;
-      for (i = k; i < n; i++) {
-         if (M[i].rep.elts()[wk] & k_mask) {
-            pos = i;
-            break;
+   for (c = 0; c < w && r < n; c += NTL_M4RI_K) {
+      long wc = c/NTL_BITS_PER_LONG;
+      long kk = 0;
+
+      for (j = c; j < w && j < c + NTL_M4RI_K && r + kk < n; j++) {
+         long wj = j/NTL_BITS_PER_LONG;
+         long bj = j - wj*NTL_BITS_PER_LONG;
+         _ntl_ulong j_mask = 1UL << bj;
+         long pos = -1;
+
+         for (i = r + kk; i < n; i++) {
+            _ntl_ulong *x = M[i].rep.elts();
+
+            // clear row i on this strip's earlier pivot columns
+
+            for (q = 0; q < kk; q++) {
+               if (x[pw[q]] & pmask[q]) {
+                  const _ntl_ulong *y = M[r + q].rep.elts();
+
+                  for (l = wc; l < wm; l++)
+                     x[l] ^= y[l];
+               }
+            }
+
+            if (x[wj] & j_mask) {
+               pos = i;
+               break;
+            }
          }
+
+         if (pos == -1)
+            continue;
+
+         if (pos != r + kk)
+            swap(M[pos], M[r + kk]);
+
+         const _ntl_ulong *y = M[r + kk].rep.elts();
+
+         for (q = 0; q < kk; q++) {
+            _ntl_ulong *x = M[r + q].rep.elts();
+
+            if (x[wj] & j_mask) {
+               for (l = wc; l < wm; l++)
+                  x[l] ^= y[l];
+            }
+         }
+
+         if (pivots)
+            (*pivots)[r + kk] = j;
+
+         pw[kk] = wj;
+         pmask[kk] = j_mask;
+         kk++;
       }
 
-      if (pos != -1) {
-         if (k != pos) {
-            swap(M[pos], M[k]);
+      if (kk == 0)
+         continue;
+
+      long any = 0;
+
+      for (i = full ? 0 : r + kk; i < n; i++) {
+         index[i] = 0;
+
+         if (i >= r && i < r + kk)
+            continue;
+
+         const _ntl_ulong *x = M[i].rep.elts();
+
+         for (q = 0; q < kk; q++) {
+            if (x[pw[q]] & pmask[q])
+               index[i] |= 1L << q;
          }
 
+         any |= index[i];
+      }
 
-         _ntl_ulong *y = M[k].rep.elts();
+      if (any) {
+         for (long w0 = wc; w0 < wm; w0 += NTL_M4RI_BLOCK) {
+            long bw = min(long(NTL_M4RI_BLOCK), wm - w0);
+            _ntl_ulong *t = table.elts();
 
-         for (i = k+1; i < n; i++) {
-            // M[i] = M[i] + M[k]*M[i,k]
+            for (l = 0; l < bw; l++)
+               t[l] = 0;
 
-            if (M[i].rep.elts()[wk] & k_mask) {
-               _ntl_ulong *x = M[i].rep.elts();
+            for (s = 1; s < (1L << kk); s++) {
+               long low = s & -s;
 
-               for (j = wk; j < wn; j++)
-                  x[j] ^= y[j];
+               for (q = 0; (1L << q) != low; q++) ;
+
+               _ntl_ulong *x = t + s*NTL_M4RI_BLOCK;
+               const _ntl_ulong *y = t + (s ^ low)*NTL_M4RI_BLOCK;
+               const _ntl_ulong *z = M[r + q].rep.elts() + w0;
+
+               for (l = 0; l < bw; l++)
+                  x[l] = y[l] ^ z[l];
             }
 
+            for (i = full ? 0 : r + kk; i < n; i++) {
+               if (index[i] == 0)
+                  continue;
+
+               _ntl_ulong *x = M[i].rep.elts() + w0;
+               const _ntl_ulong *y = t + index[i]*NTL_M4RI_BLOCK;
+
+               for (l = 0; l < bw; l++)
+                  x[l] ^= y[l];
+            }
          }
       }
-      else {
-         clear(d);
-         return;
-      }
+
+      r += kk;
    }
 
-   set(d);
-   return;
+   if (pivots)
+      pivots->SetLength(r);
+
+   return r;
+}
+
+
+void determinant(ref_GF2 d, const mat_GF2& M_in)
+{
+   long n = M_in.NumRows();
+
+   if (M_in.NumCols() != n)
+      LogicError("determinant: nonsquare matrix");
+
+   if (n == 0) {
+      set(d);
+      return;
+   }
+
+   mat_GF2 M;
+
+   M = M_in;
+
+   if (M4RI(M, n, 0) == n)
+      set(d);
+   else
+      clear(d);
 }
 
 static
@@ -426,82 +655,51 @@ void inv(ref_GF2 d, mat_GF2& X, const mat_GF2& A)
    if (n == 0) {
       X.SetDims(0, 0);
       set(d);
+      return;
    }
 
-   long i, j, k, pos;
+   long i, j;
+
+   // [A | I] is brought into reduced row echelon form [I | A^{-1}]
 
    mat_GF2 M;
    M.SetDims(n, 2*n);
 
-   vec_GF2 aa;
-   aa.SetLength(2*n);
-
-
    for (i = 0; i < n; i++) {
-      aa = A[i];
-      aa.SetLength(2*n);
-      aa.put(n+i, 1);
-      M[i] = aa;
+      VectorCopy(M[i], A[i], 2*n);
+      M[i].put(n+i, 1);
    }
 
-   long wn = ((2*n) + NTL_BITS_PER_LONG - 1)/NTL_BITS_PER_LONG;
-
-   for (k = 0; k < n; k++) {
-      long wk = k/NTL_BITS_PER_LONG;
-      long bk = k - wk*NTL_BITS_PER_LONG;
-      _ntl_ulong k_mask = 1UL << bk;
-
-      pos = -1;
-      for (i = k; i < n; i++) {
-         if (M[i].rep.elts()[wk] & k_mask) {
-            pos = i;
-            break;
-         }
-      }
-
-      if (pos != -1) {
-         if (k != pos) {
-            swap(M[pos], M[k]);
-         }
-
-         _ntl_ulong *y = M[k].rep.elts();
-
-         for (i = k+1; i < n; i++) {
-            // M[i] = M[i] + M[k]*M[i,k]
+   if (M4RI(M, n, 1) < n) {
+      clear(d);
+      return;
+   }
 
-            if (M[i].rep.elts()[wk] & k_mask) {
-               _ntl_ulong *x = M[i].rep.elts();
+   long wn = n/NTL_BITS_PER_LONG;
+   long bn = n - wn*NTL_BITS_PER_LONG;
+   long wx = (n + NTL_BITS_PER_LONG - 1)/NTL_BITS_PER_LONG;
 
-               for (j = wk; j < wn; j++)
-                  x[j] ^= y[j];
-            }
+   X.SetDims(n, n);
 
+   for (i = 0; i < n; i++) {
+      const _ntl_ulong *y = M[i].rep.elts() + wn;
+      _ntl_ulong *x = X[i].rep.elts();
 
-         }
+      if (bn == 0) {
+         for (j = 0; j < wx; j++)
+            x[j] = y[j];
       }
       else {
-         clear(d);
-         return;
-      }
-   }
-
-   vec_GF2 XX;
-   XX.SetLength(2*n);
+         for (j = 0; j < wx; j++) {
+            x[j] = y[j] >> bn;
 
-   X.SetDims(n, n);
-   clear(X);
-
-   for (j = 0; j < n; j++) {
-      XX.SetLength(n+j+1);
-      clear(XX);
-      XX.put(n+j, to_GF2(1));
-      
-      for (i = n-1; i >= 0; i--) {
-         XX.put(i, XX*M[i]);
+            if (wn + j + 1 < M[i].rep.length())
+               x[j] |= y[j+1] << (NTL_BITS_PER_LONG - bn);
+         }
       }
-   
-      XX.SetLength(n);
-      AddToCol(X, j, XX);
+
+      if (n % NTL_BITS_PER_LONG != 0)
+         x[wx-1] &= (1UL << (n % NTL_BITS_PER_LONG)) - 1UL;
    }
 
    set(d);
@@ -570,6 +768,26 @@ long gauss(mat_GF2& M)
    return gauss(M, M.NumCols());
 }
 
+long GaussJordan(mat_GF2& M, long w)
+{
+   return M4RI(M, w, 1);
+}
+
+long GaussJordan(mat_GF2& M)
+{
+   return GaussJordan(M, M.NumCols());
+}
+
+long GaussJordan(mat_GF2& M, vec_long& pivots, long w)
+{
+   return M4RI(M, w, 1, &pivots);
+}
+
+long GaussJordan(mat_GF2& M, vec_long& pivots)
+{
+   return GaussJordan(M, pivots, M.NumCols());
+}
+
 
 void image(mat_GF2& X, const mat_GF2& A)
 {
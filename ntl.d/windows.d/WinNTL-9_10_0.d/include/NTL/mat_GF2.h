@@ -5,6 +5,7 @@
 
 #include <NTL/matrix.h>
 #include <NTL/vec_vec_GF2.h>
+#include <NTL/vec_long.h>
 
 NTL_OPEN_NNS
 
@@ -85,6 +86,10 @@ long IsDiag(const mat_GF2& A, long n, GF2 d);
 
 long gauss(mat_GF2& M);
 long gauss(mat_GF2& M, long w);
+long GaussJordan(mat_GF2& M);
+long GaussJordan(mat_GF2& M, long w);
+long GaussJordan(mat_GF2& M, vec_long& pivots);
+long GaussJordan(mat_GF2& M, vec_long& pivots, long w);
 void image(mat_GF2& X, const mat_GF2& A);
 void kernel(mat_GF2& X, const mat_GF2& A);
 
@@ -0,0 +1,96 @@
+
+#include <NTL/mat_GF2.h>
+#include <NTL/BasicThreadPool.h>
+
+NTL_CLIENT
+
+
+void random(mat_GF2& X, long n, long m)
+{
+   X.SetDims(n, m);
+   long i;
+
+   for (i = 0; i < n; i++)
+      random(X[i], m);
+}
+
+// The product one row at a time, each row the sum of the rows of B
+// picked by the bits of a row of A.
+
+void RowMul(mat_GF2& X, const mat_GF2& A, const mat_GF2& B)
+{
+   long n = A.NumRows();
+   long i;
+
+   X.SetDims(n, B.NumCols());
+
+   for (i = 0; i < n; i++)
+      mul(X[i], A[i], B);
+}
+
+int main()
+{
+   long i;
+
+#ifdef NTL_THREAD_BOOST
+   SetNumThreads(4);
+   cerr << "threads " << AvailableThreads() << "\n";
+#endif
+
+   for (i = 0; i < 16; i++) {
+      mat_GF2 A, B, X, X1;
+
+      long n = RandomBnd(300) + 1;
+      long l = RandomBnd(300) + 1;
+      long m = RandomBnd(300) + 1;
+
+      random(A, n, l);
+      random(B, l, m);
+
+      mul(X, A, B);
+      RowMul(X1, A, B);
+
+      if (X != X1) TerminalError("BitMatMulTest NOT OK!!");
+
+      X = A;
+      mul(X, X, B);
+
+      if (X != X1) TerminalError("BitMatMulTest NOT OK!!");
+   }
+
+   // S*G at McEliece key sizes.
+
+   long dims[3][2] = { { 1751, 2048 }, { 2774, 3488 }, { 3888, 4608 } };
+
+   for (i = 0; i < 3; i++) {
+      mat_GF2 A, B, X, X1;
+
+      long k = dims[i][0];
+      long n = dims[i][1];
+
+      cerr << k << " " << n << "\n";
+
+      random(A, k, k);
+      random(B, k, n);
+
+      double t, t1;
+
+      cerr << "matrix mul...";
+      t = GetTime();
+      mul(X, A, B);
+      t = GetTime() - t;  cerr << t << "\n";
+
+      cerr << "row mul...";
+      t1 = GetTime();
+      RowMul(X1, A, B);
+      t1 = GetTime() - t1;  cerr << t1 << "\n";
+
+      if (X != X1) TerminalError("BitMatMulTest NOT OK!!");
+
+      cerr << "speedup " << (t1/t) << "\n\n";
+   }
+
+   cerr << "BitMatMulTest OK\n";
+
+}
+
@@ -7,9 +7,11 @@ extern "C"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 }
 
 #include <NTL/version.h>
+#include <algorithm>
 #include <ctime>
 
 #include "mcnoodle.h"
@@ -66,6 +68,619 @@ int test2(void)
   return rc;
 }
 
+int test3(void)
+{
+  int rc = 1;
+  mcnoodle_gf2m field;
+
+  if(!field.prepare(NTL::BuildIrred_GF2X(12)))
+    return 0;
+
+  std::vector<uint16_t> f(52);
+  std::vector<uint16_t> L(1 << 12);
+  std::vector<uint16_t> y1;
+  std::vector<uint16_t> y2;
+
+  for(size_t i = 0; i < f.size(); i++)
+    f[i] = static_cast<uint16_t> (NTL::RandomBnd(1 << 12));
+
+  L[0] = 0;
+  L[1] = 2;
+
+  for(size_t i = 2; i < L.size(); i++)
+    L[i] = field.mul(L[1], L[i - 1]);
+
+  field.polyEvalFFT(y1, f);
+  field.polyEvalSupport(y2, f, L);
+
+  for(size_t i = 0; i < L.size(); i++)
+    if(y1[L[i]] != field.polyEval(f, L[i]) || y2[i] != y1[L[i]])
+      rc = 0;
+
+  if(rc)
+    std::cout << "Horner's rule and additive FFT agree!" << std::endl;
+  else
+    std::cout << "Horner's rule and additive FFT disagree!" << std::endl;
+
+  return rc;
+}
+
+int test4(void)
+{
+  int rc = 1;
+  mcnoodle m(11, 51);
+
+  rc = m.generatePrivatePublicKeys();
+
+  char plaintext[] = "Binary\0with\0NULs.";
+  size_t plaintext_size = sizeof(plaintext);
+  std::vector<char> c(m.ciphertextSize());
+  std::vector<char> p(m.maximumPlaintextSize());
+  size_t p_size = p.size();
+
+  rc &= m.encrypt(plaintext, plaintext_size, &c[0], c.size());
+  rc &= m.decrypt(&c[0], c.size(), &p[0], p_size);
+
+  if(rc &= (p_size == plaintext_size &&
+	    memcmp(&p[0], plaintext, plaintext_size) == 0))
+    std::cout << "Binary p equals plaintext!" << std::endl;
+  else
+    std::cout << "Binary p does not equal plaintext!" << std::endl;
+
+  return rc;
+}
+
+int test5(void)
+{
+  int rc = 1;
+  mcnoodle m(11, 51);
+
+  rc = m.generatePrivatePublicKeys();
+
+  size_t c_size = m.ciphertextSize();
+  size_t count = 64;
+  size_t p_size = m.maximumPlaintextSize();
+  std::vector<char> c(count * c_size);
+  std::vector<char> p(count * p_size);
+  std::vector<size_t> p_sizes(count);
+  bool results[64];
+
+  for(size_t i = 0; i < count; i++)
+    {
+      char plaintext[32];
+
+      snprintf(plaintext, sizeof(plaintext), "Message %d.", (int) i);
+      rc &= m.encrypt(plaintext, strlen(plaintext), &c[i * c_size], c_size);
+    }
+
+  c[7 * c_size] ^= 1; // Not a valid header.
+  rc &= !m.decryptBatch(&c[0], count, &p[0], &p_sizes[0], results, 4);
+
+  for(size_t i = 0; i < count; i++)
+    {
+      char plaintext[32];
+
+      snprintf(plaintext, sizeof(plaintext), "Message %d.", (int) i);
+
+      if(i == 7)
+	rc &= !results[i];
+      else
+	rc &= results[i] && p_sizes[i] == strlen(plaintext) &&
+	  memcmp(&p[i * p_size], plaintext, p_sizes[i]) == 0;
+    }
+
+  if(rc)
+    std::cout << "Batch p equals plaintext!" << std::endl;
+  else
+    std::cout << "Batch p does not equal plaintext!" << std::endl;
+
+  return rc;
+}
+
+int test6(void)
+{
+  int rc = 1;
+  mcnoodle m(11, 51, true);
+
+  rc = m.generatePrivatePublicKeys();
+
+  /*
+  ** A systematic key would place the plaintext in the clear.
+  */
+
+  char plaintext[] = "A systematic public key.";
+  size_t count = 16;
+  size_t p_size = m.maximumPlaintextSize();
+  std::stringstream c;
+  std::vector<char> cs(count * m.ciphertextSize());
+  std::vector<char> ps(count * p_size);
+  std::vector<size_t> p_sizes(count, strlen(plaintext));
+
+  for(size_t i = 0; i < count; i++)
+    memcpy(&ps[i * p_size], plaintext, p_sizes[i]);
+
+  rc &= !m.encrypt(plaintext, strlen(plaintext), c);
+  rc &= !m.encrypt(plaintext, strlen(plaintext), &cs[0], m.ciphertextSize());
+  rc &= !m.encryptBatch(&ps[0], &p_sizes[0], count, &cs[0]);
+
+  if(rc)
+    std::cout << "Systematic keys refuse to encrypt!" << std::endl;
+  else
+    std::cout << "Systematic keys do not refuse to encrypt!" << std::endl;
+
+  return rc;
+}
+
+int test7(void)
+{
+  int rc = 1;
+  mcnoodle_key_pool pool(10, 38, 2, 1);
+
+  for(int i = 0; i < 600 && pool.depth() < 2; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  mcnoodle *m1 = pool.acquire();
+  mcnoodle *m2 = pool.acquire();
+
+  rc &= m1 != 0 && m2 != 0 && m1 != m2;
+  rc &= rc && m1->keygenThreads() == std::max
+    (1U, std::thread::hardware_concurrency());
+
+  if(rc)
+    {
+      char plaintext[] = "A pooled key.";
+      std::vector<char> c(m1->ciphertextSize());
+      std::vector<char> p(m1->maximumPlaintextSize());
+      size_t p_size = p.size();
+
+      /*
+      ** The worker is refilling the pool meanwhile.
+      */
+
+      rc &= m1->encrypt(plaintext, strlen(plaintext), &c[0], c.size());
+      rc &= m1->decrypt(&c[0], c.size(), &p[0], p_size);
+      rc &= p_size == strlen(plaintext) &&
+	memcmp(&p[0], plaintext, p_size) == 0;
+      rc &= !m2->decrypt(&c[0], c.size(), &p[0], p_size) ||
+	p_size != strlen(plaintext) ||
+	memcmp(&p[0], plaintext, p_size) != 0;
+    }
+
+  std::map<std::string, double> statistics(pool.statistics());
+
+  rc &= statistics["acquired"] == 2 && statistics["threads"] == 1;
+  delete m1;
+  delete m2;
+
+  if(rc)
+    std::cout << "Pooled p equals plaintext!" << std::endl;
+  else
+    std::cout << "Pooled p does not equal plaintext!" << std::endl;
+
+  return rc;
+}
+
+static std::vector<unsigned char> readFile(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  std::vector<unsigned char> file;
+
+  if(!f)
+    return file;
+
+  for(int c; (c = fgetc(f)) != EOF;)
+    file.push_back(static_cast<unsigned char> (c));
+
+  fclose(f);
+  return file;
+}
+
+int test8(void)
+{
+  int rc = 1;
+  const char *path[] = {"mcnoodle-test-1.private",
+			"mcnoodle-test-1.public",
+			"mcnoodle-test-2.private",
+			"mcnoodle-test-2.public"};
+
+  for(int i = 0; i < 2 && rc; i++)
+    {
+      mcnoodle m1(10, 38, i == 1);
+      mcnoodle m2(10, 38, i == 1);
+
+      rc &= !m1.generatePrivatePublicKeys(0);
+      rc &= m1.generatePrivatePublicKeys();
+      rc &= m2.generatePrivatePublicKeys(&m1.seed()[0]);
+      rc &= m1.seed() == m2.seed();
+
+      /*
+      ** The key files of one seed are the same byte for byte.
+      */
+
+      rc &= m1.writePrivateKey(path[0]) && m1.writePublicKey(path[1]);
+      rc &= m2.writePrivateKey(path[2]) && m2.writePublicKey(path[3]);
+      rc &= !readFile(path[0]).empty() && !readFile(path[1]).empty();
+      rc &= readFile(path[0]) == readFile(path[2]);
+      rc &= readFile(path[1]) == readFile(path[3]);
+
+      if(i == 1)
+	break;
+
+      char plaintext[] = "A key from its seed.";
+      std::stringstream c;
+      std::stringstream p;
+
+      rc &= m2.encrypt(plaintext, strlen(plaintext), c);
+      rc &= m1.decrypt(c, p);
+      rc &= p.str() == std::string(plaintext);
+    }
+
+  for(size_t i = 0; i < 4; i++)
+    remove(path[i]);
+
+  if(rc)
+    std::cout << "Seeded p equals plaintext!" << std::endl;
+  else
+    std::cout << "Seeded p does not equal plaintext!" << std::endl;
+
+  return rc;
+}
+
+int test9(void)
+{
+  int rc = 1;
+
+  for(int i = 0; i < 2; i++)
+    {
+      mcnoodle m(10, 38, i == 1);
+
+      rc &= m.generatePrivatePublicKeys();
+      rc &= m.writePrivateKey("mcnoodle-test.private");
+      rc &= m.writePublicKey("mcnoodle-test.public");
+
+      mcnoodle_decrypt_key d("mcnoodle-test.private", true);
+      mcnoodle_encrypt_key e("mcnoodle-test.public", true);
+      struct stat st;
+
+      rc &= stat("mcnoodle-test.private", &st) == 0 &&
+	(st.st_mode & 0777) == 0600;
+      rc &= d.ok() && e.ok();
+      rc &= !mcnoodle_decrypt_key("mcnoodle-test.public", false).ok();
+
+      if(!rc)
+	break;
+
+      char plaintext[] = "A mapped key.";
+      std::vector<char> c(m.ciphertextSize());
+      std::vector<char> p(m.maximumPlaintextSize());
+      size_t p_size = p.size();
+
+      if(i == 1)
+	{
+	  rc &= !e.encrypt(plaintext, strlen(plaintext), &c[0], c.size());
+	  continue;
+	}
+
+      rc &= e.encrypt(plaintext, strlen(plaintext), &c[0], c.size());
+      rc &= m.decrypt(&c[0], c.size(), &p[0], p_size);
+      rc &= p_size == strlen(plaintext) &&
+	memcmp(&p[0], plaintext, p_size) == 0;
+      p_size = p.size();
+      rc &= m.encrypt(plaintext, strlen(plaintext), &c[0], c.size());
+      rc &= d.decrypt(&c[0], c.size(), &p[0], p_size);
+      rc &= p_size == strlen(plaintext) &&
+	memcmp(&p[0], plaintext, p_size) == 0;
+    }
+
+  remove("mcnoodle-test.private");
+  remove("mcnoodle-test.public");
+
+  if(rc)
+    std::cout << "Mapped p equals plaintext!" << std::endl;
+  else
+    std::cout << "Mapped p does not equal plaintext!" << std::endl;
+
+  return rc;
+}
+
+int test10(void)
+{
+  int rc = 1;
+  const mcnoodle_field_context *context = mcnoodle_field_context::get(10);
+
+  if(!context)
+    return 0;
+
+  const mcnoodle_gf2m &field(context->field());
+
+  NTL::GF2E::init(context->modulus());
+
+  for(long int i = 0; i < 400 && rc; i++)
+    {
+      NTL::GF2EX g;
+      long int t = 2 + i % 9;
+      std::vector<uint16_t> f(static_cast<size_t> (t + 1));
+
+      for(long int j = 0; j < t; j++)
+	f[j] = static_cast<uint16_t> (NTL::RandomBnd(1 << 10));
+
+      f[t] = 1;
+
+      for(long int j = 0; j <= t; j++)
+	NTL::SetCoeff(g, j, field.toGF2E(f[j]));
+
+      rc &= field.polyIrreducible(f) == (NTL::DetIrredTest(g) != 0);
+    }
+
+  std::vector<uint16_t> f;
+  size_t attempts = 0;
+
+  rc &= field.polyRandomIrreducible
+    (f, 38, NTL::GetCurrentRandomStream(), attempts);
+  rc &= f.size() == 39 && attempts > 0;
+
+  NTL::GF2EX g;
+
+  for(size_t j = 0; j < f.size(); j++)
+    NTL::SetCoeff(g, static_cast<long int> (j), field.toGF2E(f[j]));
+
+  rc &= NTL::DetIrredTest(g) != 0;
+
+  if(rc)
+    std::cout << "Ben-Or and NTL agree!" << std::endl;
+  else
+    std::cout << "Ben-Or and NTL disagree!" << std::endl;
+
+  return rc;
+}
+
+int test11(void)
+{
+  int rc = 1;
+  mcnoodle m1(10, 38);
+  mcnoodle m2(10, 38);
+
+  /*
+  ** The smallest row blocks are forced on m2 by a budget that they
+  ** alone fit. Its key must match that of m1 from the same seed.
+  */
+
+  rc &= m1.generatePrivatePublicKeys();
+  m2.setMemoryBudget(1);
+  rc &= !m2.generatePrivatePublicKeys(&m1.seed()[0]);
+  m2.setMemoryBudget(m2.keygenMemory());
+  rc &= m2.keygenMemory() <= m2.memoryBudget();
+  rc &= m2.generatePrivatePublicKeys(&m1.seed()[0]);
+
+  char plaintext[] = "A key within a budget.";
+  std::stringstream c;
+  std::stringstream p;
+
+  rc &= m2.encrypt(plaintext, strlen(plaintext), c);
+  rc &= m1.decrypt(c, p);
+  rc &= p.str() == std::string(plaintext);
+  c.str("");
+  p.str("");
+  rc &= m1.encrypt(plaintext, strlen(plaintext), c);
+  rc &= m2.decrypt(c, p);
+  rc &= p.str() == std::string(plaintext);
+
+  if(rc)
+    std::cout << "Budgeted p equals plaintext!" << std::endl;
+  else
+    std::cout << "Budgeted p does not equal plaintext!" << std::endl;
+
+  return rc;
+}
+
+int test12(void)
+{
+  int rc = 1;
+
+  for(int i = 0; i < 2; i++)
+    {
+      mcnoodle *m = new mcnoodle(10, 38, i == 1);
+
+      rc &= m->generatePrivatePublicKeys();
+
+      mcnoodle_decrypt_key d(*m);
+      char plaintext[] = "A compact key.";
+      std::vector<char> c(m->ciphertextSize());
+      std::vector<char> p(m->maximumPlaintextSize());
+      size_t p_size = p.size();
+
+      rc &= d.ok() && d.residentSize() > 0;
+      rc &= m->encrypt(plaintext, strlen(plaintext), &c[0], c.size()) ==
+	(i == 0);
+      delete m;
+
+      if(!rc || i == 1)
+	break;
+
+      rc &= d.decrypt(&c[0], c.size(), &p[0], p_size);
+      rc &= p_size == strlen(plaintext) &&
+	memcmp(&p[0], plaintext, p_size) == 0;
+    }
+
+  rc &= !mcnoodle_decrypt_key(mcnoodle(10, 38)).ok();
+
+  if(rc)
+    std::cout << "Compact p equals plaintext!" << std::endl;
+  else
+    std::cout << "Compact p does not equal plaintext!" << std::endl;
+
+  return rc;
+}
+
+int test13(void)
+{
+  int rc = 1;
+  mcnoodle m(11, 51);
+
+  rc &= m.generatePrivatePublicKeys();
+
+  size_t c_size = m.ciphertextSize();
+  size_t count = 16;
+  size_t p_size = m.maximumPlaintextSize();
+  std::vector<char> c(count * c_size);
+  std::vector<char> c1(c_size);
+  std::vector<char> p(count * p_size);
+  std::vector<char> p1(p_size);
+  std::vector<size_t> p_sizes(count);
+
+  for(size_t j = 0; j < count; j++)
+    {
+      snprintf(&p[j * p_size], p_size, "Batched message %d.", (int) j);
+      p_sizes[j] = strlen(&p[j * p_size]);
+    }
+
+  /*
+  ** From the same random state, a batch and single encryptions in
+  ** turn give the same ciphertexts.
+  */
+
+  NTL::SetSeed(NTL::ZZ(13));
+  rc &= m.encryptBatch(&p[0], &p_sizes[0], count, &c[0]);
+  NTL::SetSeed(NTL::ZZ(13));
+
+  for(size_t j = 0; j < count; j++)
+    {
+      size_t p1_size = p1.size();
+
+      rc &= m.encrypt(&p[j * p_size], p_sizes[j], &c1[0], c1.size());
+      rc &= memcmp(&c1[0], &c[j * c_size], c_size) == 0;
+      rc &= m.decrypt(&c[j * c_size], c_size, &p1[0], p1_size);
+      rc &= p1_size == p_sizes[j] &&
+	memcmp(&p1[0], &p[j * p_size], p1_size) == 0;
+    }
+
+  if(rc)
+    std::cout << "Batch encryption equals single encryption!" << std::endl;
+  else
+    std::cout << "Batch encryption does not equal single encryption!"
+	      << std::endl;
+
+  return rc;
+}
+
+template<typename F>
+static bool tamper(const char *path,
+		   const uint32_t type,
+		   const size_t section,
+		   F change)
+{
+  /*
+  ** Applies change to a section of the key file at path, found by
+  ** its contents, and rewrites the file.
+  */
+
+  std::vector<unsigned char> file(readFile(path));
+  mcnoodle_key_file k;
+
+  if(!k.open(file, type))
+    return false;
+
+  const unsigned char *x = static_cast<const unsigned char *>
+    (k.section(section, k.sectionSize(section)));
+
+  if(!x)
+    return false;
+
+  std::vector<unsigned char>::iterator it = std::search
+    (file.begin(), file.end(), x, x + k.sectionSize(section));
+
+  if(it == file.end())
+    return false;
+
+  change(&*it);
+
+  FILE *f = fopen(path, "wb");
+
+  if(!f)
+    return false;
+
+  bool ok = fwrite(&file[0], 1, file.size(), f) == file.size();
+
+  return (fclose(f) == 0) && ok;
+}
+
+int test14(void)
+{
+  int rc = 1;
+  mcnoodle m(10, 38, true);
+  const char *path[] = {"mcnoodle-test.private", "mcnoodle-test.public"};
+  const uint32_t privateKey = mcnoodle_key_file::s_privateKey;
+
+  rc &= m.generatePrivatePublicKeys();
+
+  /*
+  ** A repeated element of L, g(z) not monic, sqrt(z) and the
+  ** syndrome table with an element of 11 bits, and Q^-1 not a
+  ** permutation.
+  */
+
+  for(int i = 0; i < 5 && rc; i++)
+    {
+      rc &= m.writePrivateKey(path[0]) && m.writePublicKey(path[1]);
+      rc &= mcnoodle_decrypt_key(path[0], true).ok() &&
+	mcnoodle_encrypt_key(path[1], true).ok();
+
+      switch(i)
+	{
+	case 0:
+	  rc &= tamper(path[0], privateKey, 2, [](unsigned char *x)
+		       {
+			 memcpy(x + 2, x, 2);
+		       });
+	  break;
+	case 1:
+	  rc &= tamper(path[0], privateKey, 0, [](unsigned char *x)
+		       {
+			 x[2 * 38] ^= 1;
+		       });
+	  break;
+	case 2:
+	  rc &= tamper(path[0], privateKey, 1, [](unsigned char *x)
+		       {
+			 uint16_t v = 1 << 10;
+
+			 memcpy(x, &v, 2);
+		       });
+	  break;
+	case 3:
+	  rc &= tamper(path[0], privateKey, 4, [](unsigned char *x)
+		       {
+			 uint16_t v = 1 << 10;
+
+			 memcpy(x, &v, 2);
+		       });
+	  break;
+	default:
+	  rc &= tamper(path[1],
+		       mcnoodle_key_file::s_publicKey,
+		       1,
+		       [](unsigned char *x)
+		       {
+			 memcpy(x + 4, x, 4);
+		       });
+	  break;
+	}
+
+      rc &= !mcnoodle_decrypt_key(path[0], false).ok() ||
+	!mcnoodle_encrypt_key(path[1], false).ok();
+    }
+
+  remove(path[0]);
+  remove(path[1]);
+
+  if(rc)
+    std::cout << "Tampered keys are rejected!" << std::endl;
+  else
+    std::cout << "Tampered keys are not rejected!" << std::endl;
+
+  return rc;
+}
+
 int main(void)
 {
   int rc = 1;
@@ -73,5 +688,17 @@ int main(void)
   std::cout << "NTL version " << NTL_VERSION << "." << std::endl;
   rc &= test1();
   rc &= test2();
+  rc &= test3();
+  rc &= test4();
+  rc &= test5();
+  rc &= test6();
+  rc &= test7();
+  rc &= test8();
+  rc &= test9();
+  rc &= test10();
+  rc &= test11();
+  rc &= test12();
+  rc &= test13();
+  rc &= test14();
   return !rc;
 }